@@ -0,0 +1,30 @@
+// Edge dilation fragment shader
+//
+// One direction of a separable dilation of the edges: the minimum
+// Laplacian over 'radius' texels either side of this one, along
+// texCoordStep.  As edges have negative Laplacians, two passes (rows
+// then columns) spread each edge over a square.
+
+#version 330
+
+in vec2 texCoords;
+
+uniform sampler2D edgeSampler;	// Laplacian, or the row pass's result
+uniform vec2      texCoordStep;	// from one texel to the next, in x or y
+uniform int       radius;
+
+layout (location = 0) out vec3 dilatedEdge;
+
+
+void main()
+
+{
+  float m = texture( edgeSampler, texCoords ).r;
+
+  for (int i=1; i<=radius; i++) {
+    m = min( m, texture( edgeSampler, texCoords - i * texCoordStep ).r );
+    m = min( m, texture( edgeSampler, texCoords + i * texCoordStep ).r );
+  }
+
+  dilatedEdge = vec3( m );
+}
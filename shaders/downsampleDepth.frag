@@ -0,0 +1,34 @@
+// Depth downsampling fragment shader
+//
+// For edges found at reduced size: the nearest and farthest depths of
+// the scale x scale window pixels under this pixel.  Edges are found
+// from the nearest, so that an object covering part of a pixel isn't
+// lost; pass 3 uses both to upsample the edges without bleeding them
+// across depth discontinuities.
+
+#version 330
+
+uniform sampler2D depthSampler;	// at window size
+uniform int       scale;
+
+layout (location = 0) out vec3 depthRange;
+
+
+void main()
+
+{
+  ivec2 size = textureSize( depthSampler, 0 );
+  ivec2 first = ivec2( gl_FragCoord.xy ) * scale;
+
+  float nearest = 1;
+  float farthest = 0;
+
+  for (int y=0; y<scale; y++)
+    for (int x=0; x<scale; x++) {
+      float d = texelFetch( depthSampler, min( first + ivec2(x,y), size-1 ), 0 ).r;
+      nearest = min( nearest, d );
+      farthest = max( farthest, d );
+    }
+
+  depthRange = vec3( nearest, farthest, 0 );
+}
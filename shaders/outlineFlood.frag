@@ -0,0 +1,39 @@
+// Outline flood fragment shader
+//
+// One step of the jump flood: keep the nearest of the edge pixels
+// known to this pixel and to the pixels 'stepSize' away in the eight
+// directions.  Steps of n/2, n/4, ..., 1 pixels find the nearest edge
+// pixel within n pixels.
+
+#version 330
+
+in vec2 texCoords;
+
+uniform sampler2D nearestEdgeSampler;
+uniform vec2      texCoordInc;	// texture coord difference between adjacent texels
+uniform float     stepSize;	// in pixels
+
+layout (location = 0) out vec3 nearestEdge;
+
+
+void main()
+
+{
+  nearestEdge = vec3( -1, -1, 1 );
+  float nearestDist = 1e20;
+
+  for (int y=-1; y<=1; y++)
+    for (int x=-1; x<=1; x++) {
+
+      vec3 edge = texture( nearestEdgeSampler, texCoords + stepSize * vec2( x, y ) * texCoordInc ).xyz;
+
+      if (edge.x >= 0) {
+	vec2 diff = edge.xy - gl_FragCoord.xy;
+	float dist = dot( diff, diff );
+	if (dist < nearestDist) {
+	  nearestDist = dist;
+	  nearestEdge = edge;
+	}
+      }
+    }
+}
@@ -0,0 +1,26 @@
+// Outline seed fragment shader
+//
+// Starts the jump flood for the outlines: an edge pixel is its own
+// nearest edge pixel, and other pixels have none yet.
+
+#version 330
+
+in vec2 texCoords;
+
+uniform sampler2D laplacianSampler;
+uniform sampler2D depthSampler;
+
+// The nearest edge pixel found so far, as (x, y, depth) with x and y
+// in window coordinates, or x < 0 if none
+
+layout (location = 0) out vec3 nearestEdge;
+
+
+void main()
+
+{
+  if (texture( laplacianSampler, texCoords ).r < -0.1)
+    nearestEdge = vec3( gl_FragCoord.xy, texture( depthSampler, texCoords ).r );
+  else
+    nearestEdge = vec3( -1, -1, 1 );
+}
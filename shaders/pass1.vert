@@ -10,7 +10,13 @@ uniform mat4 MVP;
 
 layout (location = 0) in vec3 vertPosition;
 layout (location = 1) in vec3 vertNormal;
-layout (location = 2) in vec3 vertTexCoord;
+layout (location = 2) in vec3 vertTexCoord;	// (s,t,layer of the model's texture array)
+
+// The transform of this instance of the model, applied before M.  The
+// four attributes (locations 3 to 6) are its rows, so the transform
+// is applied by multiplying with a row vector on the left.
+
+layout (location = 3) in mat4 instanceRows;
 
 // shader should compute the colour, normal (in the VCS), and
 // depth (in the range [0,1] with 0=near and 1=far) and store these
@@ -23,9 +29,14 @@ out float depth;
 void main()
 
 {
+  // position and normal of this instance in the OCS
+
+  vec4 position = vec4( vertPosition, 1.0 ) * instanceRows;
+  vec4 instanceNormal = vec4( vertNormal, 0.0 ) * instanceRows;
+
   // calc vertex position in CCS (always required)
 
-  gl_Position = MVP * vec4( vertPosition, 1.0 );
+  gl_Position = MVP * position;
 
   // Provide a colour
 
@@ -34,7 +45,7 @@ void main()
   // calculate normal in VCS
 
   normal = vec3(0,1,0);
-  normal = vec3(MV * vec4(vertNormal, 0.0));
+  normal = vec3(MV * instanceNormal);
 
   // Calculate the depth in [0,1]
 
@@ -20,23 +20,82 @@ uniform sampler2D normalSampler;
 uniform sampler2D depthSampler;
 uniform sampler2D laplacianSampler;
 
+// With flood outlines, the nearest edge pixel to each pixel, as
+// (x, y, depth), and the outline width in pixels at referenceDepth.
+// The width varies with 1-depth, which is about inversely
+// proportional to the distance from the eye.
+
+uniform bool      floodOutlines;
+uniform sampler2D nearestEdgeSampler;
+uniform float     outlineWidth;
+uniform float     maxOutlineWidth;
+uniform float     referenceDepth;
+
+// With dilated outlines, the minimum Laplacian around each pixel
+
+uniform bool      dilatedOutlines;
+uniform sampler2D dilatedEdgeSampler;
+
+// Outline textures may be 1/edgeScale of the window size.  Then
+// edgeDepthSampler has the nearest and farthest depths under each of
+// their texels.
+
+uniform int       edgeScale;
+uniform sampler2D edgeDepthSampler;
+
+// Cel shading, made on the CPU by ToonRamp.  At N.L, rampSampler has
+// the colour's quantized level, whether the pixel is lit, and the
+// depth's diffuse level.  specularSampler has the highlight at R.V,
+// from R.V = 0 at the centre of its first texel to 1 at the centre of
+// its last.
+
+uniform sampler2D rampSampler;
+uniform sampler2D specularSampler;
+
 out vec4 outputColour;          // the output fragment colour as RGBA with A=1
 
 // comment to disable
-#define DIFFUSE_COMPONENT
-#define SPECULAR_COMPONENT
 #define SILHOUETTE_BLEND
 
-#define NUM_QUANTA 3
+
+// The dilated edge value at this pixel, which has depth d.  At
+// reduced size, it comes from whichever of the four nearest texels
+// has depths closest to d, so that outlines stay on their own
+// surface.
+
+float dilatedEdge( float d )
+
+{
+  if (edgeScale == 1)
+    return texture2D(dilatedEdgeSampler, texCoords).r;
+
+  ivec2 size = textureSize(dilatedEdgeSampler, 0);
+  ivec2 base = ivec2(floor(texCoords * vec2(size) - 0.5));
+
+  float edge = 1;
+  float closest = 1e20;
+
+  for (int y = 0; y < 2; y++)
+    for (int x = 0; x < 2; x++) {
+      ivec2 t = clamp(base + ivec2(x,y), ivec2(0,0), size - 1);
+      vec2 range = texelFetch(edgeDepthSampler, t, 0).rg;
+      float diff = max(range.x - d, 0.0) + max(d - range.y, 0.0);
+      if (diff < closest) {
+        closest = diff;
+        edge = texelFetch(dilatedEdgeSampler, t, 0).r;
+      }
+    }
+
+  return edge;
+}
 
 void main()
 
 {
-  // Look up values for the depth and Laplacian.  Use only
-  // the R component of the texture as texture2D( ... ).r
+  // Look up the depth.  Use only the R component of the texture as
+  // texture2D( ... ).r
 
   float d = texture2D(depthSampler, texCoords).r;
-  float l = texture2D(laplacianSampler, texCoords).r;
 
   // Discard the fragment if it is a background pixel not
   // near the silhouette of the object.
@@ -56,44 +115,25 @@ void main()
   vec3 N = texture2D(normalSampler, texCoords).xyz;
   vec3 C = texture2D(colourSampler, texCoords).xyz;
 
-  // Compute Cel shading, in which the diffusely shaded
-  // colour is quantized into four possible values.  Do not allow the
-  // diffuse component, N dot L, to be below 0.2.  That will provide
-  // some ambient shading.  Use the 'numQuata' below
-  // to have that many divisions of quanta of colour.
+  // Cel shading, with the diffuse and specular terms, from a lookup
+  // in each ramp.  Below its minimum N.L, the pixel is black.
 
-  const int numQuanta = NUM_QUANTA;
   float ndotl = dot(normalize(N),normalize(lightDir));
-  vec3 IOut;
-
-  if (ndotl <= 0.2) {
-    return;
-  }
-
-  //Cel-shading
-  for (int i = numQuanta; i >= 1; i--) {
-    float x = (1.0 / numQuanta) * i;
-    if (ndotl > x) {
-      IOut += x * C;
-      break;
-    }
-  }
 
-  //Phong
-#ifdef DIFFUSE_COMPONENT
-  IOut += ndotl * vec3(texture2D(depthSampler, texCoords));
-#endif
-
-#ifdef SPECULAR_COMPONENT
   vec3 R = (2.0 * ndotl) * N - lightDir;
-  vec3 V = vec3(0,0,1);
+  float rdotv = R.z;		// R . V with V = (0,0,1)
 
-  float rdotv = dot(R,V);
+  vec3 ramp = texture(rampSampler, vec2(ndotl, 0.5)).rgb;
 
-  if (rdotv > 0.0) {
-    IOut += pow(rdotv, 200.0) * vec3(0.4, 0.4, 0.4);
+  if (ramp.g == 0) {
+    outputColour = vec4(0,0,0,1);
+    return;
   }
-#endif
+
+  float specularSize = float(textureSize(specularSampler, 0).x);
+  float spec = texture(specularSampler, vec2((rdotv * (specularSize - 1) + 0.5) / specularSize, 0.5)).r;
+
+  vec3 IOut = ramp.r * C + ramp.b * vec3(d) + vec3(spec);
 
   /*   Modify this shader to have a silhouette that is black in */
   /*   the middle but a blend of black and the Phong-computed colour away */
@@ -108,6 +148,33 @@ void main()
   IOut *= vec3(o);
 #endif
 
+  // Flood outlines: black within the outline width of the nearest edge
+
+  if (floodOutlines) {
+
+    vec3 edge = texture2D(nearestEdgeSampler, texCoords).xyz;
+    float width = min( outlineWidth * (1 - edge.z) / (1 - referenceDepth), maxOutlineWidth );
+
+    if (edge.x >= 0 && distance( edge.xy * edgeScale, gl_FragCoord.xy ) <= width)
+      outputColour = vec4(0,0,0,1);
+    else
+      outputColour = vec4(IOut, 1.0);
+
+    return;
+  }
+
+  // Dilated outlines: black where the dilated Laplacian is an edge
+
+  if (dilatedOutlines) {
+
+    if (dilatedEdge(d) < -0.1)
+      outputColour = vec4(0,0,0,1);
+    else
+      outputColour = vec4(IOut, 1.0);
+
+    return;
+  }
+
   // Count number of fragments in the 3x3 neighbourhood of
   // this fragment with a Laplacian that is less than -0.1.  These are
   // the edge fragments.  Use the 'kernelRadius'
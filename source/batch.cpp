@@ -0,0 +1,453 @@
+// Batch turntable renderer
+//
+// Usage: shader -batch list.txt [-threads n] [-loaders n] [-angles n] [-size WxH] [-out dir] [-cpu] [-trace file.json]
+//
+// Each line of list.txt names a model and, optionally, the number of
+// angles at which to render it:
+//
+//    data/teapot.obj 36
+//    data/apple.obj
+//
+// Loader threads read the models ahead of time into a bounded queue.
+// Each worker thread has its own headless OpenGL context and Renderer,
+// takes the next loaded model, renders its turntable sequence (the
+// same rotation as display() in shader.cpp) and deletes it.  Frames
+// are written as PPM files if an output directory is given.
+//
+// With -cpu, the workers use the CPURenderer instead and need no
+// OpenGL at all.  They share one thread pool for their tiles.
+//
+// With -trace, a profile of all threads is written at the end.
+
+
+#include "headers.h"
+#include "batch.h"
+#include "glContext.h"
+#include "renderer.h"
+#include "cpuRenderer.h"
+#include "shader.h"
+#include "syncQueue.h"
+#include "profiler.h"
+
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+
+class BatchJob {
+public:
+  char *filename;
+  int   numAngles;
+};
+
+
+class LoadedModel {
+public:
+  BatchJob *job;
+  wfModel  *model;
+};
+
+
+// Settings
+
+static int   numWorkers     = 0;	// 0 = one per core
+static int   numLoaders     = 1;
+static int   defaultAngles  = 36;
+static int   frameWidth     = 600;
+static int   frameHeight    = 450;
+static char *outputDir      = NULL;
+static bool  useCPU         = false;
+static char *traceFile      = NULL;
+
+// Shared state
+
+static seq<BatchJob>          jobs;
+static syncQueue<LoadedModel> *loaded;
+static std::atomic<int>       nextJob( 0 );
+static std::atomic<long>      framesRendered( 0 );
+static std::atomic<int>       modelsRendered( 0 );
+static std::atomic<int>       liveWorkers( 0 );
+static ThreadPool            *cpuPool = NULL;
+
+
+static void readJobList( char *filename )
+
+{
+  FILE *file = fopen( filename, "r" );
+  if (!file) {
+    cerr << "runBatch: can't open model list '" << filename << "'" << endl;
+    exit(1);
+  }
+
+  char line[1000], name[1000];
+
+  while (fgets( line, sizeof(line), file )) {
+
+    int angles = defaultAngles;
+
+    if (sscanf( line, "%s %d", name, &angles ) < 1 || name[0] == '#')
+      continue;
+
+    BatchJob job;
+    job.filename = strdup( name );
+    job.numAngles = (angles > 0 ? angles : defaultAngles);
+    jobs.add( job );
+  }
+
+  fclose( file );
+}
+
+
+// Write an image as a binary (P6) PPM file.  The pixels are
+// bottom-to-top, as read from OpenGL.
+
+static void writeP6( char *filename, int width, int height, unsigned char *pixels )
+
+{
+  PROFILE_ZONE( "writeP6" );
+
+  FILE *file = fopen( filename, "wb" );
+  if (!file) {
+    cerr << "runBatch: can't write '" << filename << "'" << endl;
+    return;
+  }
+
+  fprintf( file, "P6\n%d %d\n255\n", width, height );
+
+  for (int y=height-1; y>=0; y--)
+    fwrite( &pixels[ y * width * 3 ], 1, width * 3, file );
+
+  fclose( file );
+}
+
+
+// Read models ahead of the workers.  Only the CPU side of each model
+// (its textures and its vertex, index and draw buffers) is built here;
+// the workers set up the OpenGL objects in their own contexts.
+
+static void loaderThread()
+
+{
+  Profiler::setThreadName( "loader" );
+
+  int i;
+
+  while ((i = nextJob++) < jobs.size()) {
+
+    LoadedModel item;
+
+    item.job = &jobs[i];
+    item.model = new wfModel();
+    item.model->read( item.job->filename );
+    item.model->buildBuffers();
+
+    if (!loaded->push( item )) { // queue closed: the workers have stopped
+      delete item.model;
+      return;
+    }
+  }
+}
+
+
+// Output file for one frame: <outputDir>/<model base name>_<frame>.ppm,
+// in a buffer of 'size' chars.  Returns false if it doesn't fit.
+
+static bool frameFilename( char *filename, int size, char *modelFilename, int frame )
+
+{
+  char *base = strrchr( modelFilename, '/' );
+  base = (base != NULL ? base+1 : modelFilename);
+
+  char *ext = strrchr( base, '.' );
+  int baseLength = (ext != NULL ? ext - base : strlen( base ));
+
+  if (snprintf( filename, size, "%s/%.*s_%04d.ppm", outputDir, baseLength, base, frame ) >= size) {
+    cerr << "runBatch: output path for '" << modelFilename << "' is too long" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+// Same camera and light as in shader.cpp
+
+static const float initEyeDistance = 5.0;
+
+
+static void workerThread( int id, double *workerFPS )
+
+{
+  Profiler::setThreadName( "GL worker" );
+
+  *workerFPS = 0;
+
+  GLContext context;
+
+  if (!context.create() || !context.makeCurrent()) {
+    cerr << "runBatch: worker " << id << " has no OpenGL context" << endl;
+    if (--liveWorkers == 0)
+      loaded->close();		// nobody left to render: stop the loaders
+    return;
+  }
+
+  // The final image goes to a framebuffer object since there is no window
+
+  GLuint fbo, colourBuffer;
+
+  glGenRenderbuffers( 1, &colourBuffer );
+  glBindRenderbuffer( GL_RENDERBUFFER, colourBuffer );
+  glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, frameWidth, frameHeight );
+
+  glGenFramebuffers( 1, &fbo );
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, fbo );
+  glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer );
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+  Renderer *renderer = new Renderer( frameWidth, frameHeight );
+  renderer->setOutputFramebuffer( fbo );
+
+  GLState::viewport( 0, 0, frameWidth, frameHeight );
+  glClearColor( 1.0, 1.0, 1.0, 0.0 );
+
+  unsigned char *pixels = (outputDir != NULL ? new unsigned char[ frameWidth * frameHeight * 3 ] : NULL);
+
+  float fovy = 2 * atan2( 1, initEyeDistance );
+
+  vec3 lightDir(1,1,0.2);
+  lightDir = lightDir.normalize();
+
+  long frames = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  LoadedModel item;
+
+  while (loaded->pop( item )) {
+
+    wfModel *obj = item.model;
+    obj->setupVAO();
+
+    bool isTorso = isTorsoModel( item.job->filename );
+    vec3 eyePosition = (initEyeDistance * obj->radius) * vec3(0,0,1);
+
+    for (int a=0; a<item.job->numAngles; a++) {
+
+      float theta = 2 * M_PI * a / (float) item.job->numAngles;
+
+      mat4 M, MV, MVP;
+      modelTransforms( obj, theta, isTorso, eyePosition, fovy, frameWidth / (float) frameHeight, M, MV, MVP );
+
+      renderer->render( obj, M, MV, MVP, lightDir );
+
+      char filename[2000];
+
+      if (pixels != NULL && frameFilename( filename, sizeof(filename), item.job->filename, a )) {
+
+	{
+	  PROFILE_ZONE( "glReadPixels" );
+	  GLState::bindFramebuffer( GL_READ_FRAMEBUFFER, fbo );
+	  glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+	  glReadPixels( 0, 0, frameWidth, frameHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels );
+	}
+	writeP6( filename, frameWidth, frameHeight, pixels );
+      }
+    }
+
+    // Wait for the GPU so that the frame count is honest
+
+    {
+      PROFILE_ZONE( "glFinish" );
+      glFinish();
+    }
+
+    frames += item.job->numAngles;
+    framesRendered += item.job->numAngles;
+    modelsRendered++;
+
+    delete obj;
+  }
+
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  *workerFPS = (seconds > 0 ? frames / seconds : 0);
+
+  delete [] pixels;
+  delete renderer;
+  glDeleteFramebuffers( 1, &fbo );
+  glDeleteRenderbuffers( 1, &colourBuffer );
+}
+
+
+// The same, with the CPU renderer
+
+static void cpuWorkerThread( int id, double *workerFPS )
+
+{
+  Profiler::setThreadName( "CPU worker" );
+
+  CPURenderer *renderer = new CPURenderer( frameWidth, frameHeight, cpuPool );
+
+  float fovy = 2 * atan2( 1, initEyeDistance );
+
+  vec3 lightDir(1,1,0.2);
+  lightDir = lightDir.normalize();
+
+  long frames = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  LoadedModel item;
+
+  while (loaded->pop( item )) {
+
+    wfModel *obj = item.model;
+
+    bool isTorso = isTorsoModel( item.job->filename );
+    vec3 eyePosition = (initEyeDistance * obj->radius) * vec3(0,0,1);
+
+    for (int a=0; a<item.job->numAngles; a++) {
+
+      float theta = 2 * M_PI * a / (float) item.job->numAngles;
+
+      mat4 M, MV, MVP;
+      modelTransforms( obj, theta, isTorso, eyePosition, fovy, frameWidth / (float) frameHeight, M, MV, MVP );
+
+      renderer->render( obj, M, MV, MVP, lightDir );
+
+      char filename[2000];
+
+      if (outputDir != NULL && frameFilename( filename, sizeof(filename), item.job->filename, a ))
+	writeP6( filename, frameWidth, frameHeight, renderer->pixels() );
+    }
+
+    frames += item.job->numAngles;
+    framesRendered += item.job->numAngles;
+    modelsRendered++;
+
+    delete obj;
+  }
+
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  *workerFPS = (seconds > 0 ? frames / seconds : 0);
+
+  delete renderer;
+}
+
+
+int runBatch( int argc, char **argv )
+
+{
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " -batch list.txt [-threads n] [-loaders n] [-angles n] [-size WxH] [-out dir] [-cpu] [-trace file.json]" << endl;
+    return 1;
+  }
+
+  char *listFile = argv[2];
+
+  for (int i=3; i<argc; i++)
+    if (strcmp( argv[i], "-threads" ) == 0 && i+1 < argc)
+      numWorkers = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-loaders" ) == 0 && i+1 < argc)
+      numLoaders = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-angles" ) == 0 && i+1 < argc)
+      defaultAngles = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-size" ) == 0 && i+1 < argc)
+      sscanf( argv[++i], "%dx%d", &frameWidth, &frameHeight );
+    else if (strcmp( argv[i], "-out" ) == 0 && i+1 < argc)
+      outputDir = argv[++i];
+    else if (strcmp( argv[i], "-cpu" ) == 0)
+      useCPU = true;
+    else if (strcmp( argv[i], "-trace" ) == 0 && i+1 < argc)
+      traceFile = argv[++i];
+    else {
+      cerr << "runBatch: unknown option '" << argv[i] << "'" << endl;
+      return 1;
+    }
+
+  // The CPU renderer spreads each frame across all cores, so it needs
+  // only a couple of workers: one renders while another writes files
+
+  if (numWorkers <= 0)
+    numWorkers = (useCPU ? 2 : std::thread::hardware_concurrency());
+  if (numWorkers <= 0)
+    numWorkers = 1;
+  if (numLoaders <= 0)
+    numLoaders = 1;
+
+  readJobList( listFile );
+
+  if (jobs.size() == 0) {
+    cerr << "runBatch: no models in '" << listFile << "'" << endl;
+    return 1;
+  }
+
+  if (outputDir != NULL)
+    mkdir( outputDir, 0777 );
+
+  // With one context per core, a software rasterizer (llvmpipe) should
+  // not start its own thread per core in every context as well
+
+  if (numWorkers > 1)
+    setenv( "LP_NUM_THREADS", "1", 0 );
+
+  if (useCPU)
+    cpuPool = new ThreadPool();
+
+  if (traceFile != NULL)
+    Profiler::start();
+
+  // Keep a couple of models per worker loaded ahead
+
+  loaded = new syncQueue<LoadedModel>( 2 * numWorkers );
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::thread **loaders = new std::thread*[ numLoaders ];
+  for (int i=0; i<numLoaders; i++)
+    loaders[i] = new std::thread( loaderThread );
+
+  liveWorkers = numWorkers;
+
+  std::thread **workers = new std::thread*[ numWorkers ];
+  double *workerFPS = new double[ numWorkers ];
+  for (int i=0; i<numWorkers; i++)
+    workers[i] = new std::thread( (useCPU ? cpuWorkerThread : workerThread), i, &workerFPS[i] );
+
+  // When all models are loaded, close the queue so that the workers
+  // stop once it is empty
+
+  for (int i=0; i<numLoaders; i++) {
+    loaders[i]->join();
+    delete loaders[i];
+  }
+
+  loaded->close();
+
+  for (int i=0; i<numWorkers; i++) {
+    workers[i]->join();
+    delete workers[i];
+  }
+
+  double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+  // Report
+
+  for (int i=0; i<numWorkers; i++)
+    printf( "worker %d: %.1f frames/sec\n", i, workerFPS[i] );
+
+  printf( "%d of %d models, %ld frames in %.2f sec: %.1f frames/sec with %d threads\n",
+	  (int) modelsRendered, jobs.size(), (long) framesRendered, seconds,
+	  (seconds > 0 ? framesRendered / seconds : 0.0), numWorkers );
+
+  if (traceFile != NULL) {
+    Profiler::stop();
+    Profiler::writeTrace( traceFile );
+  }
+
+  delete [] loaders;
+  delete [] workers;
+  delete [] workerFPS;
+  delete loaded;
+  delete cpuPool;
+
+  return (modelsRendered == jobs.size() ? 0 : 1);
+}
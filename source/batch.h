@@ -0,0 +1,13 @@
+/* batch.h
+ *
+ * Render turntable sequences of many models without a window, spread
+ * across a pool of threads that each have their own OpenGL context
+ * and Renderer.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+int runBatch( int argc, char **argv );
+
+#endif
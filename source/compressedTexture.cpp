@@ -0,0 +1,342 @@
+// S3TC block compression of textures, with a disk cache
+
+
+#include "compressedTexture.h"
+#include "mipmap.h"
+#include "profiler.h"
+
+#include <sys/stat.h>
+#include <stdio.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+// Start of a cache file.  The levels follow, largest first.
+
+class CacheHeader {
+ public:
+  char      magic[4];		// "BCTX"
+  unsigned  format, width, height, numLevels;
+  long long sourceSize, sourceTime;
+};
+
+
+static unsigned int to565( int rgb[3] )
+
+{
+  return (((rgb[0] * 31 + 127) / 255) << 11) | (((rgb[1] * 63 + 127) / 255) << 5) | ((rgb[2] * 31 + 127) / 255);
+}
+
+
+static void from565( unsigned int c, int rgb[3] )
+
+{
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+// BC1 colour block: two 565 endpoints, c0 >= c1 for the four-colour
+// mode, and a 2-bit index per texel into c0, c1, 2/3 c0 + 1/3 c1,
+// 1/3 c0 + 2/3 c1
+
+static void encodeColour( GLubyte px[16][4], GLubyte *out )
+
+{
+  int lo[3] = { 255, 255, 255 };
+  int hi[3] = { 0, 0, 0 };
+
+  for (int i=0; i<16; i++)
+    for (int c=0; c<3; c++) {
+      if (px[i][c] < lo[c]) lo[c] = px[i][c];
+      if (px[i][c] > hi[c]) hi[c] = px[i][c];
+    }
+
+  // Inset the box by 1/16, so that the ends aren't wasted on outliers
+
+  for (int c=0; c<3; c++) {
+    int inset = (hi[c] - lo[c]) >> 4;
+    lo[c] += inset;
+    hi[c] -= inset;
+  }
+
+  unsigned int c0 = to565( hi );
+  unsigned int c1 = to565( lo );
+  unsigned int indices = 0;
+
+  if (c0 != c1) {
+
+    // Project each texel onto the line from c1 (t=0) to c0 (t=3)
+
+    int e0[3], e1[3];
+    from565( c0, e0 );
+    from565( c1, e1 );
+
+    float dir[3] = { (float) (e0[0]-e1[0]), (float) (e0[1]-e1[1]), (float) (e0[2]-e1[2]) };
+    float scale = 3 / (dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+
+    float ch[3][16];
+    for (int i=0; i<16; i++)
+      for (int c=0; c<3; c++)
+	ch[c][i] = px[i][c] - e1[c];
+
+    int t[16];
+
+#ifdef __SSE2__
+    __m128 d0 = _mm_set1_ps( dir[0] * scale );
+    __m128 d1 = _mm_set1_ps( dir[1] * scale );
+    __m128 d2 = _mm_set1_ps( dir[2] * scale );
+    __m128i zero = _mm_setzero_si128();
+    __m128i three = _mm_set1_epi32( 3 );
+
+    for (int i=0; i<16; i+=4) {
+      __m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &ch[0][i] ), d0 ),
+					   _mm_mul_ps( _mm_loadu_ps( &ch[1][i] ), d1 ) ),
+			       _mm_mul_ps( _mm_loadu_ps( &ch[2][i] ), d2 ) );
+      __m128i ti = _mm_cvtps_epi32( dot );
+      ti = _mm_min_epi16( _mm_max_epi16( ti, zero ), three ); // small values, so 16-bit min/max do
+      _mm_storeu_si128( (__m128i *) &t[i], ti );
+    }
+#else
+    for (int i=0; i<16; i++) {
+      float dot = (ch[0][i] * dir[0] + ch[1][i] * dir[1] + ch[2][i] * dir[2]) * scale;
+      t[i] = (dot < 0 ? 0 : dot > 3 ? 3 : (int) (dot + 0.5f));
+    }
+#endif
+
+    static const int indexOf[4] = { 1, 3, 2, 0 }; // t -> palette entry
+
+    for (int i=0; i<16; i++)
+      indices |= indexOf[ t[i] ] << (2*i);
+  }
+
+  out[0] = c0 & 255;  out[1] = c0 >> 8;
+  out[2] = c1 & 255;  out[3] = c1 >> 8;
+  out[4] = indices & 255;
+  out[5] = (indices >> 8) & 255;
+  out[6] = (indices >> 16) & 255;
+  out[7] = indices >> 24;
+}
+
+
+// BC3 alpha block: a0 > a1 for the eight-value mode, and a 3-bit
+// index per texel into a0, a1 and six values between
+
+static void encodeAlpha( GLubyte px[16][4], GLubyte *out )
+
+{
+  int a0 = 0, a1 = 255;
+
+  for (int i=0; i<16; i++) {
+    if (px[i][3] > a0) a0 = px[i][3];
+    if (px[i][3] < a1) a1 = px[i][3];
+  }
+
+  unsigned long long bits = 0;
+
+  if (a0 > a1)
+    for (int i=0; i<16; i++) {
+      int k = (int) ((px[i][3] - a1) * 7.0f / (a0 - a1) + 0.5f); // 0 at a1 ... 7 at a0
+      int index = (k == 7 ? 0 : k == 0 ? 1 : 8-k);
+      bits |= (unsigned long long) index << (3*i);
+    }
+
+  out[0] = a0;
+  out[1] = a1;
+
+  for (int j=0; j<6; j++)
+    out[2+j] = (bits >> (8*j)) & 255;
+}
+
+
+// Compress one image.  Blocks past the right or bottom edge repeat
+// the last column or row.
+
+static void compressImage( GLubyte *src, int width, int height, int channels, GLubyte *dest, ThreadPool *pool )
+
+{
+  int blocksWide = (width+3) / 4;
+  int blocksHigh = (height+3) / 4;
+  int blockBytes = (channels == 4 ? 16 : 8);
+
+  auto blockRow = [&]( int by ) {
+
+    GLubyte px[16][4];
+    GLubyte *out = dest + (long) by * blocksWide * blockBytes;
+
+    for (int bx=0; bx<blocksWide; bx++, out += blockBytes) {
+
+      for (int y=0; y<4; y++)
+	for (int x=0; x<4; x++) {
+	  int sx = (4*bx+x < width  ? 4*bx+x : width-1);
+	  int sy = (4*by+y < height ? 4*by+y : height-1);
+	  GLubyte *p = src + ((long) sy * width + sx) * channels;
+	  px[4*y+x][0] = p[0];
+	  px[4*y+x][1] = p[1];
+	  px[4*y+x][2] = p[2];
+	  px[4*y+x][3] = (channels == 4 ? p[3] : 255);
+	}
+
+      if (channels == 4) {
+	encodeAlpha( px, out );
+	encodeColour( px, out+8 );
+      } else
+	encodeColour( px, out );
+    }
+  };
+
+  if (pool != NULL)
+    pool->parallelFor( blocksHigh, blockRow );
+  else
+    for (int by=0; by<blocksHigh; by++)
+      blockRow( by );
+}
+
+
+long CompressedTexture::levelBytes( int level )
+
+{
+  long blocks = (long) ((mipLevelSize( width, level ) + 3) / 4) * ((mipLevelSize( height, level ) + 3) / 4);
+
+  return blocks * (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8);
+}
+
+
+void CompressedTexture::compress( GLubyte **images, int w, int h, int n, bool hasAlpha, ThreadPool *pool )
+
+{
+  PROFILE_ZONE( "CompressedTexture::compress" );
+
+  format = (hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+  width = w;
+  height = h;
+  numLevels = n;
+  levels = new GLubyte*[ numLevels ];
+
+  for (int l=0; l<numLevels; l++) {
+    levels[l] = new GLubyte[ levelBytes( l ) ];
+    compressImage( images[l], mipLevelSize( width, l ), mipLevelSize( height, l ),
+		   (hasAlpha ? 4 : 3), levels[l], pool );
+  }
+}
+
+
+char *CompressedTexture::cacheName( const char *sourceFile )
+
+{
+  char *name = new char[ strlen(sourceFile) + 4 ];
+
+  strcpy( name, sourceFile );
+  strcat( name, ".bc" );
+
+  return name;
+}
+
+
+bool CompressedTexture::read( const char *sourceFile )
+
+{
+  PROFILE_ZONE( "CompressedTexture::read" );
+
+  struct stat source;
+  if (stat( sourceFile, &source ) != 0)
+    return false;
+
+  char *name = cacheName( sourceFile );
+  FILE *f = fopen( name, "rb" );
+  delete [] name;
+
+  if (f == NULL)
+    return false;
+
+  CacheHeader header;
+
+  bool ok = (fread( &header, sizeof(header), 1, f ) == 1 &&
+	     strncmp( header.magic, "BCTX", 4 ) == 0 &&
+	     header.sourceSize == (long long) source.st_size &&
+	     header.sourceTime == (long long) source.st_mtime &&
+	     (header.format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+	      header.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) &&
+	     header.numLevels == (unsigned) numMipLevels( header.width, header.height ));
+
+  if (ok) {
+
+    format = header.format;
+    width = header.width;
+    height = header.height;
+    numLevels = header.numLevels;
+    levels = new GLubyte*[ numLevels ];
+
+    for (int l=0; l<numLevels; l++) {
+      levels[l] = new GLubyte[ levelBytes( l ) ];
+      if (ok && fread( levels[l], levelBytes( l ), 1, f ) != 1)
+	ok = false;
+    }
+  }
+
+  fclose( f );
+  return ok;
+}
+
+
+// Written to a temporary file first, so that a half-written cache is
+// never read
+
+void CompressedTexture::write( const char *sourceFile )
+
+{
+  PROFILE_ZONE( "CompressedTexture::write" );
+
+  struct stat source;
+  if (stat( sourceFile, &source ) != 0)
+    return;
+
+  char *name = cacheName( sourceFile );
+  char *tempName = new char[ strlen(name) + 5 ];
+
+  strcpy( tempName, name );
+  strcat( tempName, ".tmp" );
+
+  FILE *f = fopen( tempName, "wb" );
+
+  if (f == NULL)
+    cerr << "CompressedTexture: Can't write cache '" << tempName << "'" << endl;
+
+  else {
+
+    CacheHeader header;
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, "BCTX", 4 );
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.numLevels = numLevels;
+    header.sourceSize = source.st_size;
+    header.sourceTime = source.st_mtime;
+
+    bool ok = (fwrite( &header, sizeof(header), 1, f ) == 1);
+
+    for (int l=0; l<numLevels; l++)
+      if (ok && fwrite( levels[l], levelBytes( l ), 1, f ) != 1)
+	ok = false;
+
+    if (fclose( f ) != 0)
+      ok = false;
+
+    if (ok)
+      rename( tempName, name );
+    else {
+      cerr << "CompressedTexture: Failed to write cache '" << name << "'" << endl;
+      remove( tempName );
+    }
+  }
+
+  delete [] name;
+  delete [] tempName;
+}
@@ -0,0 +1,63 @@
+/* compressedTexture.h
+ *
+ * A texture's mipmap levels in S3TC block compression: BC1 (DXT1) for
+ * RGB textures and BC3 (DXT5) for RGBA.  Each 4x4 block's colours are
+ * fitted to a line between the corners of its (slightly inset)
+ * bounding box, with SSE2 for the projections, and block rows are
+ * encoded in parallel.  This is a fast encoder, not a best-quality one.
+ *
+ * Compressed textures are cached on disk next to their source file,
+ * as <source>.bc, and a cache file is used only while the source has
+ * the size and modification time recorded in it.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     compress( levels, width, height, numLevels, hasAlpha, pool )
+ *                                Compress 8-bit RGB or RGBA levels (as
+ *                                from mipmap.h), on pool (may be NULL)
+ *     read( sourceFile )         Load the cache of sourceFile; false if
+ *                                there is none or it is out of date
+ *     write( sourceFile )        Store the cache of sourceFile
+ *     levelBytes( level )        Size of a compressed level
+ */
+
+
+#ifndef COMPRESSEDTEXTURE_H
+#define COMPRESSEDTEXTURE_H
+
+#include "headers.h"
+#include "threadPool.h"
+
+
+class CompressedTexture {
+
+  char *cacheName( const char *sourceFile );
+
+ public:
+
+  GLenum    format;		// GL_COMPRESSED_RGB_S3TC_DXT1_EXT or GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+  int       width, height;	// of level 0
+  int       numLevels;
+  GLubyte **levels;
+
+  CompressedTexture() {
+    format = 0;
+    width = height = numLevels = 0;
+    levels = NULL;
+  }
+
+  ~CompressedTexture() {
+    for (int l=0; l<numLevels; l++)
+      delete [] levels[l];
+    delete [] levels;
+  }
+
+  void compress( GLubyte **images, int width, int height, int numLevels, bool hasAlpha, ThreadPool *pool );
+
+  bool read( const char *sourceFile );
+  void write( const char *sourceFile );
+
+  long levelBytes( int level );
+};
+
+#endif
@@ -0,0 +1,542 @@
+// CPU reference renderer
+
+
+#include "headers.h"
+#include "cpuRenderer.h"
+#include "profiler.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+#define ROWS_PER_TASK 16	// rows per task in the full-screen passes
+
+
+CPURenderer::CPURenderer( int windowWidth, int windowHeight, ThreadPool *threadPool )
+
+{
+  pool = threadPool;
+  width = windowWidth;
+  height = windowHeight;
+  debug = 0;
+
+  meshModel = NULL;
+  clipPositions = NULL;
+  triangles = NULL;
+
+  // Several chunks per thread so that uneven chunks balance out
+
+  numChunks = 4 * pool->size();
+  bins = NULL;
+
+  allocateBuffers();
+}
+
+
+CPURenderer::~CPURenderer()
+
+{
+  freeBuffers();
+  delete [] clipPositions;
+  delete [] triangles;
+}
+
+
+void CPURenderer::allocateBuffers()
+
+{
+  tilesX = (width + TILE_SIZE-1) / TILE_SIZE;
+  tilesY = (height + TILE_SIZE-1) / TILE_SIZE;
+
+  int n = width * height;
+
+  colour    = new float[ 3*n ];
+  normal    = new float[ 3*n ];
+  depth     = new float[ n ];
+  zbuffer   = new float[ n ];
+  laplacian = new float[ n ];
+  edges     = new unsigned char[ n ];
+  image     = new unsigned char[ 3*n ];
+
+  bins = new std::vector<int>[ numChunks * tilesX * tilesY ];
+}
+
+
+void CPURenderer::freeBuffers()
+
+{
+  delete [] colour;
+  delete [] normal;
+  delete [] depth;
+  delete [] zbuffer;
+  delete [] laplacian;
+  delete [] edges;
+  delete [] image;
+  delete [] bins;
+}
+
+
+void CPURenderer::reshape( int windowWidth, int windowHeight )
+
+{
+  freeBuffers();
+  width = windowWidth;
+  height = windowHeight;
+  allocateBuffers();
+}
+
+
+// Copy the model's triangles the first time it is drawn
+
+void CPURenderer::setModel( wfModel *obj )
+
+{
+  if (obj == meshModel)
+    return;
+
+  obj->buildMesh( mesh );
+  meshModel = obj;
+
+  delete [] clipPositions;
+  delete [] triangles;
+
+  clipPositions = new vec4[ mesh.numPositions ];
+  triangles = new ScreenTriangle[ mesh.numTriangles ];
+}
+
+
+// Transform a triangle to window coordinates and set up its edge
+// functions.  Returns false if it covers no pixel.
+//
+// There is no clipping: triangles that reach behind the eye are
+// dropped, and the near and far planes are applied per pixel by the
+// depth range test.
+
+bool CPURenderer::setupTriangle( int t, mat4 &MV, ScreenTriangle &tri )
+
+{
+  for (int k=0; k<3; k++) {
+
+    vec4 &c = clipPositions[ mesh.indices[3*t+k] ];
+
+    if (c.w <= 1e-6)
+      return false;
+
+    tri.invW[k] = 1 / c.w;
+    tri.x[k] = (c.x * tri.invW[k] * 0.5 + 0.5) * width;
+    tri.y[k] = (c.y * tri.invW[k] * 0.5 + 0.5) * height;
+    tri.z[k] = (c.z * tri.invW[k] * 0.5 + 0.5);
+  }
+
+  if ((tri.z[0] < 0 && tri.z[1] < 0 && tri.z[2] < 0) ||
+      (tri.z[0] > 1 && tri.z[1] > 1 && tri.z[2] > 1))
+    return false;
+
+  // Twice the signed area.  Both windings are drawn, as there is no
+  // face culling in Renderer.
+
+  float area = (tri.x[1]-tri.x[0]) * (tri.y[2]-tri.y[0]) - (tri.x[2]-tri.x[0]) * (tri.y[1]-tri.y[0]);
+
+  if (area == 0)
+    return false;
+
+  float sign = (area > 0 ? 1 : -1);
+
+  for (int k=0; k<3; k++) {
+    int i = (k+1) % 3;
+    int j = (k+2) % 3;
+    tri.edgeA[k] = sign * (tri.y[i] - tri.y[j]);
+    tri.edgeB[k] = sign * (tri.x[j] - tri.x[i]);
+    tri.edgeC[k] = sign * (tri.x[i] * tri.y[j] - tri.x[j] * tri.y[i]);
+  }
+
+  tri.invArea = 1 / (sign * area);
+
+  // Pixel centres are at (x+0.5,y+0.5)
+
+  float minX = fmin( tri.x[0], fmin( tri.x[1], tri.x[2] ) );
+  float maxX = fmax( tri.x[0], fmax( tri.x[1], tri.x[2] ) );
+  float minY = fmin( tri.y[0], fmin( tri.y[1], tri.y[2] ) );
+  float maxY = fmax( tri.y[0], fmax( tri.y[1], tri.y[2] ) );
+
+  if (maxX < 0 || maxY < 0 || minX > width || minY > height)
+    return false;
+
+  tri.minX = (int) fmax( 0, ceil( minX - 0.5 ) );
+  tri.maxX = (int) fmin( width-1, floor( maxX - 0.5 ) );
+  tri.minY = (int) fmax( 0, ceil( minY - 0.5 ) );
+  tri.maxY = (int) fmin( height-1, floor( maxY - 0.5 ) );
+
+  if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+    return false;
+
+  // Normals as in pass1.vert: MV * (n,0), not normalized
+
+  for (int k=0; k<3; k++) {
+    vec3 &n = mesh.normals[3*t+k];
+    vec4 nv = MV * vec4( n.x, n.y, n.z, 0 );
+    tri.n[k] = vec3( nv.x, nv.y, nv.z );
+  }
+
+  return true;
+}
+
+
+// Store the pass 1 outputs at a pixel that passed the depth test
+
+void CPURenderer::writeFragment( ScreenTriangle &tri, int x, int y, float e0, float e1, float e2 )
+
+{
+  int i = y * width + x;
+
+  // Perspective-correct weights
+
+  float w0 = e0 * tri.invW[0];
+  float w1 = e1 * tri.invW[1];
+  float w2 = e2 * tri.invW[2];
+  float s = 1 / (w0 + w1 + w2);
+  w0 *= s; w1 *= s; w2 *= s;
+
+  colour[3*i+0] = 2.0 * 0.2;	// pass1.vert's colour
+  colour[3*i+1] = 2.0 * 0.3;
+  colour[3*i+2] = 2.0 * 0.4;
+
+  normal[3*i+0] = w0 * tri.n[0].x + w1 * tri.n[1].x + w2 * tri.n[2].x;
+  normal[3*i+1] = w0 * tri.n[0].y + w1 * tri.n[1].y + w2 * tri.n[2].y;
+  normal[3*i+2] = w0 * tri.n[0].z + w1 * tri.n[1].z + w2 * tri.n[2].z;
+
+  depth[i] = w0 * tri.z[0] + w1 * tri.z[1] + w2 * tri.z[2];
+}
+
+
+// Rasterize the part of a triangle inside [x0,x1]x[y0,y1].  The edge
+// functions are evaluated four pixels at a time with SSE.
+
+void CPURenderer::rasterizeTriangle( ScreenTriangle &tri, int x0, int y0, int x1, int y1 )
+
+{
+  for (int y=y0; y<=y1; y++) {
+
+    float py = y + 0.5;
+    float row0 = tri.edgeB[0] * py + tri.edgeC[0];
+    float row1 = tri.edgeB[1] * py + tri.edgeC[1];
+    float row2 = tri.edgeB[2] * py + tri.edgeC[2];
+
+    float *zrow = &zbuffer[ y * width ];
+
+    int x = x0;
+
+#ifdef __SSE2__
+
+    __m128 A0 = _mm_set1_ps( tri.edgeA[0] ), R0 = _mm_set1_ps( row0 );
+    __m128 A1 = _mm_set1_ps( tri.edgeA[1] ), R1 = _mm_set1_ps( row1 );
+    __m128 A2 = _mm_set1_ps( tri.edgeA[2] ), R2 = _mm_set1_ps( row2 );
+    __m128 Z0 = _mm_set1_ps( tri.z[0] * tri.invArea );
+    __m128 Z1 = _mm_set1_ps( tri.z[1] * tri.invArea );
+    __m128 Z2 = _mm_set1_ps( tri.z[2] * tri.invArea );
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps( 1.0f );
+    __m128 laneOffsets = _mm_set_ps( 3.5f, 2.5f, 1.5f, 0.5f );
+
+    for (; x+3<=x1; x+=4) {
+
+      __m128 px = _mm_add_ps( _mm_set1_ps( (float) x ), laneOffsets );
+
+      __m128 e0 = _mm_add_ps( _mm_mul_ps( A0, px ), R0 );
+      __m128 e1 = _mm_add_ps( _mm_mul_ps( A1, px ), R1 );
+      __m128 e2 = _mm_add_ps( _mm_mul_ps( A2, px ), R2 );
+
+      __m128 inside = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( e0, zero ), _mm_cmpge_ps( e1, zero ) ),
+				  _mm_cmpge_ps( e2, zero ) );
+
+      if (_mm_movemask_ps( inside ) == 0)
+	continue;
+
+      // Depth test (GL_LESS) and depth range
+
+      __m128 z = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e0, Z0 ), _mm_mul_ps( e1, Z1 ) ), _mm_mul_ps( e2, Z2 ) );
+      __m128 zOld = _mm_loadu_ps( &zrow[x] );
+
+      __m128 pass = _mm_and_ps( inside, _mm_and_ps( _mm_cmplt_ps( z, zOld ),
+						    _mm_and_ps( _mm_cmpge_ps( z, zero ), _mm_cmple_ps( z, one ) ) ) );
+
+      int mask = _mm_movemask_ps( pass );
+
+      if (mask == 0)
+	continue;
+
+      _mm_storeu_ps( &zrow[x], _mm_or_ps( _mm_and_ps( pass, z ), _mm_andnot_ps( pass, zOld ) ) );
+
+      float e0s[4], e1s[4], e2s[4];
+      _mm_storeu_ps( e0s, e0 );
+      _mm_storeu_ps( e1s, e1 );
+      _mm_storeu_ps( e2s, e2 );
+
+      for (int lane=0; lane<4; lane++)
+	if (mask & (1 << lane))
+	  writeFragment( tri, x+lane, y, e0s[lane], e1s[lane], e2s[lane] );
+    }
+
+#endif
+
+    // Remaining pixels, one at a time
+
+    for (; x<=x1; x++) {
+
+      float px = x + 0.5;
+      float e0 = tri.edgeA[0] * px + row0;
+      float e1 = tri.edgeA[1] * px + row1;
+      float e2 = tri.edgeA[2] * px + row2;
+
+      if (e0 < 0 || e1 < 0 || e2 < 0)
+	continue;
+
+      float z = (e0 * tri.z[0] + e1 * tri.z[1] + e2 * tri.z[2]) * tri.invArea;
+
+      if (z < zrow[x] && z >= 0 && z <= 1) {
+	zrow[x] = z;
+	writeFragment( tri, x, y, e0, e1, e2 );
+      }
+    }
+  }
+}
+
+
+// Pass 1 for one tile: clear it if 'clear', then draw the triangles
+// binned to it, in their original order.
+
+void CPURenderer::rasterizeTile( int tile, bool clear )
+
+{
+  int numTiles = tilesX * tilesY;
+
+  int x0 = (tile % tilesX) * TILE_SIZE;
+  int y0 = (tile / tilesX) * TILE_SIZE;
+  int x1 = (x0 + TILE_SIZE < width  ? x0 + TILE_SIZE : width)  - 1;
+  int y1 = (y0 + TILE_SIZE < height ? y0 + TILE_SIZE : height) - 1;
+
+  // Clear to the window clear colour, as glClear() does to the G-buffers
+
+  if (clear)
+    for (int y=y0; y<=y1; y++)
+      for (int x=x0; x<=x1; x++) {
+	int i = y * width + x;
+	colour[3*i+0] = colour[3*i+1] = colour[3*i+2] = 1;
+	normal[3*i+0] = normal[3*i+1] = normal[3*i+2] = 1;
+	depth[i] = 1;
+	zbuffer[i] = 1;
+      }
+
+  for (int c=0; c<numChunks; c++) {
+
+    std::vector<int> &bin = bins[ c * numTiles + tile ];
+
+    for (unsigned int i=0; i<bin.size(); i++) {
+      ScreenTriangle &tri = triangles[ bin[i] ];
+      rasterizeTriangle( tri,
+			 (tri.minX > x0 ? tri.minX : x0), (tri.minY > y0 ? tri.minY : y0),
+			 (tri.maxX < x1 ? tri.maxX : x1), (tri.maxY < y1 ? tri.maxY : y1) );
+    }
+  }
+}
+
+
+static unsigned char toByte( float v )
+
+{
+  if (v <= 0)
+    return 0;
+  if (v >= 1)
+    return 255;
+  return (unsigned char) (v * 255 + 0.5);
+}
+
+
+// Pass 3 for one row, as in pass3.frag with its default #defines
+// (silhouette blend on; 3x3 edge search, done beforehand into
+// 'edges').  The cel shading is from the functions that Renderer's
+// ramp texture is made of.
+
+void CPURenderer::shadeRow( int y, vec3 &lightDir )
+
+{
+  vec3 L = lightDir.normalize();
+
+  for (int x=0; x<width; x++) {
+
+    int i = y * width + x;
+    unsigned char *out = &image[3*i];
+
+    float d = depth[i];
+
+    if (d >= 1) {
+      out[0] = out[1] = out[2] = 255;
+      continue;
+    }
+
+    vec3 N( &normal[3*i] );
+    vec3 C( &colour[3*i] );
+
+    float ndotl = N.normalize() * L;
+
+    if (ramp.lit( ndotl ) == 0) {
+      out[0] = out[1] = out[2] = 0;
+      continue;
+    }
+
+    // Cel shading, diffuse and specular
+
+    vec3 R = (2.0 * ndotl) * N - lightDir;
+    float rdotv = R.z;
+
+    float grey = ramp.diffuse( ndotl ) * d + ramp.specular( rdotv );
+
+    vec3 IOut = ramp.band( ndotl ) * C + grey * vec3(1,1,1);
+
+    // Silhouette blend (pass3.frag assumes a 600x450 window here)
+
+    float u = 2 * (x + 0.5) / 600.0 - 1;
+    float v = 2 * (y + 0.5) / 450.0 - 1;
+    IOut = (5 * (u*u + v*v)) * IOut;
+
+    // Black if there's an edge in the 3x3 neighbourhood
+
+    if (edges[i])
+      out[0] = out[1] = out[2] = 0;
+    else {
+      out[0] = toByte( IOut.x );
+      out[1] = toByte( IOut.y );
+      out[2] = toByte( IOut.z );
+    }
+  }
+}
+
+
+// Debugging output, laid out as in Renderer::showTextures()
+//
+// LL = colour
+// UL = normal
+// UR = depth
+// LR = Laplacian
+
+void CPURenderer::drawGBuffers( int y )
+
+{
+  int halfWidth = width / 2;
+  int halfHeight = height / 2;
+
+  bool top = (y >= halfHeight);
+  int sy = (top ? (y - halfHeight) * height / (height - halfHeight) : y * height / halfHeight);
+
+  for (int x=0; x<width; x++) {
+
+    bool right = (x >= halfWidth);
+    int sx = (right ? (x - halfWidth) * width / (width - halfWidth) : x * width / halfWidth);
+    int i = sy * width + sx;
+
+    unsigned char *out = &image[ 3 * (y * width + x) ];
+
+    if (!top && !right) {
+      out[0] = toByte( colour[3*i+0] ); out[1] = toByte( colour[3*i+1] ); out[2] = toByte( colour[3*i+2] );
+    } else if (top && !right) {
+      out[0] = toByte( normal[3*i+0] ); out[1] = toByte( normal[3*i+1] ); out[2] = toByte( normal[3*i+2] );
+    } else if (top && right) {
+      out[0] = out[1] = out[2] = toByte( depth[i] );
+    } else {
+      out[0] = out[1] = out[2] = (debug == 1 ? 0 : toByte( laplacian[i] ));
+    }
+  }
+}
+
+
+// Render the scene in three passes.
+
+
+void CPURenderer::render( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, vec3 &lightDir )
+
+{
+  PROFILE_ZONE( "CPURenderer::render" );
+
+  setModel( obj );
+
+  int numTiles = tilesX * tilesY;
+  int numRowTasks = (height + ROWS_PER_TASK-1) / ROWS_PER_TASK;
+
+  // Each instance of the model is drawn in turn, with its transform
+  // applied before MV and MVP as in Renderer's separate draws, into
+  // the same G-buffers.  Tiles are cleared before the first.
+
+  for (int inst=0; inst<obj->getNumInstances(); inst++) {
+
+    mat4 &T = obj->instanceTransform( inst );
+    mat4 MVT = MV * T, MVPT = MVP * T;
+
+    // Transform the vertices to the CCS
+
+    const int vertsPerTask = 4096;
+
+    pool->parallelFor( (mesh.numPositions + vertsPerTask-1) / vertsPerTask, [&]( int task ) {
+	int last = (task+1) * vertsPerTask;
+	if (last > mesh.numPositions)
+	  last = mesh.numPositions;
+	for (int i=task*vertsPerTask; i<last; i++) {
+	  vec3 &p = mesh.positions[i];
+	  clipPositions[i] = MVPT * vec4( p.x, p.y, p.z, 1 );
+	}
+      } );
+
+    // Set up the triangles and bin them to tiles.  Each chunk has its
+    // own bins so that chunks can be done in parallel.
+
+    pool->parallelFor( numChunks, [&]( int c ) {
+
+	for (int tile=0; tile<numTiles; tile++)
+	  bins[ c * numTiles + tile ].clear();
+
+	int first = (int) ((long) c * mesh.numTriangles / numChunks);
+	int last  = (int) ((long) (c+1) * mesh.numTriangles / numChunks);
+
+	for (int t=first; t<last; t++) {
+
+	  ScreenTriangle &tri = triangles[t];
+
+	  if (!setupTriangle( t, MVT, tri ))
+	    continue;
+
+	  for (int ty=tri.minY/TILE_SIZE; ty<=tri.maxY/TILE_SIZE; ty++)
+	    for (int tx=tri.minX/TILE_SIZE; tx<=tri.maxX/TILE_SIZE; tx++)
+	      bins[ c * numTiles + ty * tilesX + tx ].push_back( t );
+	}
+      } );
+
+    // Pass 1: Store colour, normal, depth in G-Buffers
+
+    pool->parallelFor( numTiles, [&]( int tile ) {
+	rasterizeTile( tile, inst == 0 );
+      } );
+  }
+
+  if (debug == 1) {
+    pool->parallelFor( height, [&]( int y ) { drawGBuffers( y ); } );
+    return;
+  }
+
+  // Pass 2: Store Laplacian (computed from depths) in G-Buffer
+
+  computeLaplacian( depth, laplacian, width, height, 1, pool );
+
+  if (debug == 2) {
+    pool->parallelFor( height, [&]( int y ) { drawGBuffers( y ); } );
+    return;
+  }
+
+  // Pass 3: Draw everything using data from G-Buffers
+
+  dilateEdges( laplacian, edges, width, height, -0.1, 1, pool );
+
+  pool->parallelFor( numRowTasks, [&]( int task ) {
+      for (int y=task*ROWS_PER_TASK; y<(task+1)*ROWS_PER_TASK && y<height; y++)
+	shadeRow( y, lightDir );
+    } );
+}
@@ -0,0 +1,106 @@
+// CPU reference renderer
+//
+// The same three passes as Renderer, done in software: rasterize
+// each instance of the model into colour, normal and depth buffers
+// (as pass1.vert and pass1.frag do), compute the Laplacian of the
+// depths (pass2.frag), and cel shade with a black silhouette
+// (pass3.frag).  The screen is split into tiles that are rasterized
+// in parallel on a ThreadPool.
+//
+// This is a fallback for machines without a GPU and a reference to
+// check the GPU output against.
+
+#ifndef CPURENDERER_H
+#define CPURENDERER_H
+
+
+#include "wavefront.h"
+#include "threadPool.h"
+#include "edgeDetect.h"
+#include "toonRamp.h"
+
+#include <vector>
+
+
+class CPURenderer {
+
+  enum { TILE_SIZE = 64 };
+
+  // A triangle after transformation to window coordinates
+
+  class ScreenTriangle {
+  public:
+    float x[3], y[3];		// window position
+    float z[3];			// window depth in [0,1], which is also pass 1's depth output
+    float invW[3];		// 1/w, for perspective-correct interpolation
+    vec3  n[3];			// normal in the VCS
+    float edgeA[3], edgeB[3], edgeC[3]; // edge functions; edge k is opposite vertex k
+    float invArea;
+    int   minX, minY, maxX, maxY; // pixels covered by the bounding box
+  };
+
+  ThreadPool *pool;
+
+  int width, height;
+  int tilesX, tilesY;
+
+  // G-buffers, stored bottom row first like OpenGL textures
+
+  float *colour;		// RGB
+  float *normal;		// RGB
+  float *depth;			// depth output of pass 1 (perspective-correct)
+  float *zbuffer;		// window depth, for the depth test
+  float *laplacian;
+  unsigned char *edges;		// 255 near an edge, as found by pass 3's neighbourhood search
+
+  unsigned char *image;		// final RGB image, bottom row first
+
+  // The model's triangles, copied once per model
+
+  wfModel *meshModel;
+  wfMesh   mesh;
+
+  // Per-frame data
+
+  vec4 *clipPositions;
+  ScreenTriangle *triangles;
+  int   numChunks;		// triangles are set up and binned in this many chunks
+  std::vector<int> *bins;	// bins[ chunk * numTiles + tile ] = triangles overlapping tile
+
+  void allocateBuffers();
+  void freeBuffers();
+  void setModel( wfModel *obj );
+
+  bool setupTriangle( int t, mat4 &MV, ScreenTriangle &tri );
+  void rasterizeTile( int tile, bool clear );
+  void rasterizeTriangle( ScreenTriangle &tri, int x0, int y0, int x1, int y1 );
+  void writeFragment( ScreenTriangle &tri, int x, int y, float e0, float e1, float e2 );
+
+  void shadeRow( int row, vec3 &lightDir );
+  void drawGBuffers( int row );
+
+ public:
+
+  int debug;			// as in Renderer: 0 = final image, 1 or 2 = G-buffers after that pass
+  ToonRamp ramp;		// cel shading, as in Renderer
+
+  CPURenderer( int windowWidth, int windowHeight, ThreadPool *threadPool );
+  ~CPURenderer();
+
+  void reshape( int windowWidth, int windowHeight );
+
+  void render( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, vec3 &lightDir );
+
+  void forgetModel() {		// call before deleting the last model rendered
+    meshModel = NULL;
+  }
+
+  // The last rendered image: width x height RGB bytes, bottom row
+  // first, as glReadPixels() would return it
+
+  unsigned char *pixels() {
+    return image;
+  }
+};
+
+#endif
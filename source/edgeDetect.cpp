@@ -0,0 +1,493 @@
+// Image-space edge detection on depth images
+
+
+#include "edgeDetect.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+
+#define ROWS_PER_BAND 32	// rows per task
+
+#define MAX_DIRECT_BOX_RADIUS     4  // beyond this, horizontal sums use a running sum
+#define MAX_DIRECT_DILATE_RADIUS  8  // beyond this, horizontal dilation uses a running count
+
+
+static inline int clampIndex( int i, int n )
+
+{
+  return (i < 0 ? 0 : (i >= n ? n-1 : i));
+}
+
+
+// ---------------- row kernels ----------------
+//
+// 'Padded' inputs have r valid elements before in[0] and after in[w-1].
+
+
+// out[x] = sum of rows[i][x]
+
+static void sumRows( const float **rows, int n, float *out, int w )
+
+{
+  for (int x=0; x<w; x++) {
+    float sum = 0;
+    for (int i=0; i<n; i++)
+      sum += rows[i][x];
+    out[x] = sum;
+  }
+}
+
+
+// out[x] = in[x-r] + ... + in[x+r], from a padded input
+
+static void boxRow( const float *in, int r, float *out, int w )
+
+{
+  if (r > MAX_DIRECT_BOX_RADIUS) {
+
+    double sum = 0;
+    for (int k=-r; k<=r; k++)
+      sum += in[k];
+
+    for (int x=0; x<w; x++) {
+      out[x] = sum;
+      if (x+1 < w)
+	sum += in[x+r+1] - in[x-r];
+    }
+    return;
+  }
+
+  for (int x=0; x<w; x++) {
+    float sum = 0;
+    for (int k=-r; k<=r; k++)
+      sum += in[x+k];
+    out[x] = sum;
+  }
+}
+
+
+// out = k * centre - box
+
+static void laplacianRow( const float *centre, const float *box, float k, float *out, int w )
+
+{
+  for (int x=0; x<w; x++)
+    out[x] = k * centre[x] - box[x];
+}
+
+
+// mask = 255 where lap < threshold, else 0
+
+static void thresholdRow( const float *lap, float threshold, unsigned char *mask, int w )
+
+{
+  for (int x=0; x<w; x++)
+    mask[x] = (lap[x] < threshold ? 255 : 0);
+}
+
+
+// out[x] = in[x-r] | ... | in[x+r], from a padded input
+
+static void dilateRow( const unsigned char *in, int r, unsigned char *out, int w )
+
+{
+  if (r > MAX_DIRECT_DILATE_RADIUS) {
+
+    int count = 0;
+    for (int k=-r; k<=r; k++)
+      count += (in[k] != 0);
+
+    for (int x=0; x<w; x++) {
+      out[x] = (count > 0 ? 255 : 0);
+      if (x+1 < w)
+	count += (in[x+r+1] != 0) - (in[x-r] != 0);
+    }
+    return;
+  }
+
+  for (int x=0; x<w; x++) {
+    unsigned char v = 0;
+    for (int k=-r; k<=r; k++)
+      v |= in[x+k];
+    out[x] = v;
+  }
+}
+
+
+// out[x] = rows[0][x] | ... | rows[n-1][x]
+
+static void orRows( const unsigned char **rows, int n, unsigned char *out, int w )
+
+{
+  for (int x=0; x<w; x++) {
+    unsigned char v = 0;
+    for (int i=0; i<n; i++)
+      v |= rows[i][x];
+    out[x] = v;
+  }
+}
+
+
+#ifdef HAVE_AVX2_KERNELS
+
+// The same kernels with AVX2.  Each does 8 floats or 32 bytes at a
+// time and finishes the row with the scalar version.
+
+
+__attribute__((target("avx2")))
+static void sumRowsAVX2( const float **rows, int n, float *out, int w )
+
+{
+  int x = 0;
+
+  for (; x+8<=w; x+=8) {
+    __m256 sum = _mm256_loadu_ps( &rows[0][x] );
+    for (int i=1; i<n; i++)
+      sum = _mm256_add_ps( sum, _mm256_loadu_ps( &rows[i][x] ) );
+    _mm256_storeu_ps( &out[x], sum );
+  }
+
+  for (; x<w; x++) {
+    float sum = 0;
+    for (int i=0; i<n; i++)
+      sum += rows[i][x];
+    out[x] = sum;
+  }
+}
+
+
+__attribute__((target("avx2")))
+static void boxRowAVX2( const float *in, int r, float *out, int w )
+
+{
+  if (r > MAX_DIRECT_BOX_RADIUS) {
+    boxRow( in, r, out, w );
+    return;
+  }
+
+  int x = 0;
+
+  for (; x+8<=w; x+=8) {
+    __m256 sum = _mm256_loadu_ps( &in[x-r] );
+    for (int k=-r+1; k<=r; k++)
+      sum = _mm256_add_ps( sum, _mm256_loadu_ps( &in[x+k] ) );
+    _mm256_storeu_ps( &out[x], sum );
+  }
+
+  boxRow( in + x, r, out + x, w - x );
+}
+
+
+__attribute__((target("avx2")))
+static void laplacianRowAVX2( const float *centre, const float *box, float k, float *out, int w )
+
+{
+  __m256 kk = _mm256_set1_ps( k );
+  int x = 0;
+
+  for (; x+8<=w; x+=8)
+    _mm256_storeu_ps( &out[x], _mm256_sub_ps( _mm256_mul_ps( kk, _mm256_loadu_ps( &centre[x] ) ),
+					      _mm256_loadu_ps( &box[x] ) ) );
+
+  laplacianRow( centre + x, box + x, k, out + x, w - x );
+}
+
+
+__attribute__((target("avx2")))
+static void thresholdRowAVX2( const float *lap, float threshold, unsigned char *mask, int w )
+
+{
+  __m256  t = _mm256_set1_ps( threshold );
+  __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+  int x = 0;
+
+  for (; x+32<=w; x+=32) {
+
+    // Comparisons give 0 or -1 per float.  Saturating packs turn 32 of
+    // them into 32 bytes of 0 or 0xff, in an order that the final
+    // permute straightens out.
+
+    __m256i a = _mm256_castps_si256( _mm256_cmp_ps( _mm256_loadu_ps( &lap[x   ] ), t, _CMP_LT_OQ ) );
+    __m256i b = _mm256_castps_si256( _mm256_cmp_ps( _mm256_loadu_ps( &lap[x+ 8] ), t, _CMP_LT_OQ ) );
+    __m256i c = _mm256_castps_si256( _mm256_cmp_ps( _mm256_loadu_ps( &lap[x+16] ), t, _CMP_LT_OQ ) );
+    __m256i d = _mm256_castps_si256( _mm256_cmp_ps( _mm256_loadu_ps( &lap[x+24] ), t, _CMP_LT_OQ ) );
+
+    __m256i bytes = _mm256_packs_epi16( _mm256_packs_epi32( a, b ), _mm256_packs_epi32( c, d ) );
+
+    _mm256_storeu_si256( (__m256i *) &mask[x], _mm256_permutevar8x32_epi32( bytes, order ) );
+  }
+
+  thresholdRow( lap + x, threshold, mask + x, w - x );
+}
+
+
+__attribute__((target("avx2")))
+static void dilateRowAVX2( const unsigned char *in, int r, unsigned char *out, int w )
+
+{
+  if (r > MAX_DIRECT_DILATE_RADIUS) {
+    dilateRow( in, r, out, w );
+    return;
+  }
+
+  int x = 0;
+
+  for (; x+32<=w; x+=32) {
+    __m256i v = _mm256_loadu_si256( (const __m256i *) &in[x-r] );
+    for (int k=-r+1; k<=r; k++)
+      v = _mm256_or_si256( v, _mm256_loadu_si256( (const __m256i *) &in[x+k] ) );
+    _mm256_storeu_si256( (__m256i *) &out[x], v );
+  }
+
+  dilateRow( in + x, r, out + x, w - x );
+}
+
+
+__attribute__((target("avx2")))
+static void orRowsAVX2( const unsigned char **rows, int n, unsigned char *out, int w )
+
+{
+  int x = 0;
+
+  for (; x+32<=w; x+=32) {
+    __m256i v = _mm256_loadu_si256( (const __m256i *) &rows[0][x] );
+    for (int i=1; i<n; i++)
+      v = _mm256_or_si256( v, _mm256_loadu_si256( (const __m256i *) &rows[i][x] ) );
+    _mm256_storeu_si256( (__m256i *) &out[x], v );
+  }
+
+  for (; x<w; x++) {
+    unsigned char v = 0;
+    for (int i=0; i<n; i++)
+      v |= rows[i][x];
+    out[x] = v;
+  }
+}
+
+#endif
+
+
+// The kernels for this processor, chosen at start-up
+
+class RowKernels {
+ public:
+  void (*sumRows)( const float **rows, int n, float *out, int w );
+  void (*boxRow)( const float *in, int r, float *out, int w );
+  void (*laplacianRow)( const float *centre, const float *box, float k, float *out, int w );
+  void (*thresholdRow)( const float *lap, float threshold, unsigned char *mask, int w );
+  void (*dilateRow)( const unsigned char *in, int r, unsigned char *out, int w );
+  void (*orRows)( const unsigned char **rows, int n, unsigned char *out, int w );
+
+  RowKernels() {
+    sumRows = ::sumRows;
+    boxRow = ::boxRow;
+    laplacianRow = ::laplacianRow;
+    thresholdRow = ::thresholdRow;
+    dilateRow = ::dilateRow;
+    orRows = ::orRows;
+
+#ifdef HAVE_AVX2_KERNELS
+    if (__builtin_cpu_supports( "avx2" )) {
+      sumRows = sumRowsAVX2;
+      boxRow = boxRowAVX2;
+      laplacianRow = laplacianRowAVX2;
+      thresholdRow = thresholdRowAVX2;
+      dilateRow = dilateRowAVX2;
+      orRows = orRowsAVX2;
+    }
+#endif
+  }
+};
+
+static RowKernels kernels;
+
+
+// ---------------- band processing ----------------
+
+
+// Scratch rows for one band of the Laplacian
+
+class LaplacianRows {
+
+  const float *depth;
+  int          width, height, radius;
+  const float **rows;
+  float       *paddedSum;	// vertical sums, padded by 'radius' on each side
+  float       *box;
+
+ public:
+
+  LaplacianRows( const float *d, int w, int h, int r ) {
+    depth = d;
+    width = w;
+    height = h;
+    radius = r;
+    rows = new const float*[ 2*r+1 ];
+    paddedSum = new float[ w + 2*r ];
+    box = new float[ w ];
+  }
+
+  ~LaplacianRows() {
+    delete [] rows;
+    delete [] paddedSum;
+    delete [] box;
+  }
+
+  // Compute row y of the Laplacian into 'out'
+
+  void compute( int y, float *out ) {
+
+    for (int i=0; i<2*radius+1; i++)
+      rows[i] = depth + clampIndex( y-radius+i, height ) * width;
+
+    float *sum = paddedSum + radius;
+
+    kernels.sumRows( rows, 2*radius+1, sum, width );
+
+    for (int k=1; k<=radius; k++) {
+      sum[-k] = sum[0];
+      sum[width-1+k] = sum[width-1];
+    }
+
+    kernels.boxRow( sum, radius, box, width );
+
+    float n = 2*radius+1;
+    kernels.laplacianRow( depth + y * width, box, n * n, out, width );
+  }
+};
+
+
+// Edge search over rows [y0,y1).  The Laplacian comes from
+// 'laplacian' if given, or else is computed from 'depth' row by row.
+//
+// The dilation is separable: each Laplacian row is thresholded and
+// dilated horizontally into a ring of the last 2r+1 rows, and each
+// output row is the OR of the ring.
+
+static void edgeBand( const float *depth, const float *laplacian, unsigned char *edges,
+		      int width, int height, int laplacianRadius, float threshold, int r,
+		      int y0, int y1 )
+
+{
+  int ringSize = 2*r+1;
+
+  unsigned char  *ring = new unsigned char[ ringSize * width ];
+  unsigned char **ringRows = new unsigned char*[ ringSize ];
+  unsigned char  *paddedMask = new unsigned char[ width + 2*r ];
+  unsigned char  *mask = paddedMask + r;
+
+  LaplacianRows *lapRows = NULL;
+  float         *lapRow = NULL;
+
+  if (laplacian == NULL) {
+    lapRows = new LaplacianRows( depth, width, height, laplacianRadius );
+    lapRow = new float[ width ];
+  }
+
+  for (int yy=y0-r; yy<y1+r; yy++) {
+
+    int src = clampIndex( yy, height );
+
+    const float *lap;
+
+    if (laplacian != NULL)
+      lap = laplacian + src * width;
+    else {
+      lapRows->compute( src, lapRow );
+      lap = lapRow;
+    }
+
+    kernels.thresholdRow( lap, threshold, mask, width );
+
+    for (int k=1; k<=r; k++) {
+      mask[-k] = mask[0];
+      mask[width-1+k] = mask[width-1];
+    }
+
+    kernels.dilateRow( mask, r, &ring[ ((yy - (y0-r)) % ringSize) * width ], width );
+
+    // The ring now holds rows yy-2r to yy, which is what output row
+    // yy-r needs
+
+    int y = yy - r;
+
+    if (y >= y0) {
+      for (int i=0; i<ringSize; i++)
+	ringRows[i] = &ring[ i * width ];
+      kernels.orRows( (const unsigned char **) ringRows, ringSize, edges + y * width, width );
+    }
+  }
+
+  delete [] ring;
+  delete [] ringRows;
+  delete [] paddedMask;
+  delete lapRows;
+  delete [] lapRow;
+}
+
+
+// Run 'band' over bands of rows, in parallel if there is a pool
+
+static void forEachBand( int height, ThreadPool *pool, const std::function<void(int,int)> &band )
+
+{
+  int numBands = (height + ROWS_PER_BAND-1) / ROWS_PER_BAND;
+
+  std::function<void(int)> body = [&]( int i ) {
+    int y0 = i * ROWS_PER_BAND;
+    int y1 = (y0 + ROWS_PER_BAND < height ? y0 + ROWS_PER_BAND : height);
+    band( y0, y1 );
+  };
+
+  if (pool != NULL)
+    pool->parallelFor( numBands, body );
+  else
+    for (int i=0; i<numBands; i++)
+      body( i );
+}
+
+
+void computeLaplacian( const float *depth, float *laplacian, int width, int height,
+		       int radius, ThreadPool *pool )
+
+{
+  if (radius < 1)
+    radius = 1;
+
+  forEachBand( height, pool, [&]( int y0, int y1 ) {
+      LaplacianRows rows( depth, width, height, radius );
+      for (int y=y0; y<y1; y++)
+	rows.compute( y, laplacian + y * width );
+    } );
+}
+
+
+void dilateEdges( const float *laplacian, unsigned char *edges, int width, int height,
+		  float threshold, int radius, ThreadPool *pool )
+
+{
+  if (radius < 0)
+    radius = 0;
+
+  forEachBand( height, pool, [&]( int y0, int y1 ) {
+      edgeBand( NULL, laplacian, edges, width, height, 0, threshold, radius, y0, y1 );
+    } );
+}
+
+
+void detectEdges( const float *depth, unsigned char *edges, int width, int height,
+		  EdgeOptions &options, ThreadPool *pool )
+
+{
+  int lapRadius = (options.laplacianRadius < 1 ? 1 : options.laplacianRadius);
+  int radius = (options.dilationRadius < 0 ? 0 : options.dilationRadius);
+
+  forEachBand( height, pool, [&]( int y0, int y1 ) {
+      edgeBand( depth, NULL, edges, width, height, lapRadius, options.threshold, radius, y0, y1 );
+    } );
+}
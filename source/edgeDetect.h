@@ -0,0 +1,59 @@
+/* edgeDetect.h
+ *
+ * Image-space edge detection on depth images: the CPU counterpart of
+ * the toon outline passes.  computeLaplacian() is pass2.frag and
+ * dilateEdges() is the edge search of pass3.frag, both generalized to
+ * any radius.  detectEdges() does both in one pass that streams
+ * through the rows, and is the one to use on large images.
+ *
+ * Images are width x height floats (or bytes), row after row.  Lookups
+ * outside the image read the nearest border pixel.  The work is split
+ * into bands of rows on the ThreadPool, if one is given, and the row
+ * kernels use AVX2 when the processor has it.
+ *
+ *   computeLaplacian( depth, lap, w, h, r, pool )
+ *
+ *      lap = (2r+1)^2 * centre - sum of the (2r+1)x(2r+1) neighbourhood,
+ *      which for r = 1 is the 3x3 kernel of pass2.frag
+ *
+ *   dilateEdges( lap, edges, w, h, threshold, r, pool )
+ *
+ *      edges = 255 where some pixel in the (2r+1)x(2r+1) neighbourhood
+ *      has a Laplacian below the threshold, 0 elsewhere
+ *
+ *   detectEdges( depth, edges, w, h, options, pool )
+ *
+ *      both of the above, without storing the Laplacian
+ */
+
+
+#ifndef EDGEDETECT_H
+#define EDGEDETECT_H
+
+#include "threadPool.h"
+
+
+class EdgeOptions {
+ public:
+  int   laplacianRadius;	// 1 = the 3x3 kernel of pass2.frag
+  int   dilationRadius;		// 1 = the 3x3 neighbourhood of pass3.frag
+  float threshold;		// edge where the Laplacian is below this
+
+  EdgeOptions() {
+    laplacianRadius = 1;
+    dilationRadius = 1;
+    threshold = -0.1;
+  }
+};
+
+
+void computeLaplacian( const float *depth, float *laplacian, int width, int height,
+		       int radius, ThreadPool *pool );
+
+void dilateEdges( const float *laplacian, unsigned char *edges, int width, int height,
+		  float threshold, int radius, ThreadPool *pool );
+
+void detectEdges( const float *depth, unsigned char *edges, int width, int height,
+		  EdgeOptions &options, ThreadPool *pool );
+
+#endif
@@ -0,0 +1,162 @@
+// Offline toon outlines from depth images
+//
+// Usage: edges in.pfm out.pgm [-radius r] [-laplacian r] [-threshold t] [-threads n] [-bench n]
+//
+// Reads a depth image as a greyscale PFM (in [0,1], 1 = background,
+// as pass 1 stores it) and writes the outline as a PGM: black where
+// the edge search of pass3.frag finds an edge, white elsewhere.
+//
+// -radius is the edge search radius and -laplacian the Laplacian
+// radius (both 1 in pass3.frag and pass2.frag).  -bench n repeats the
+// detection n times and reports the rate.
+
+
+#include "edgeDetect.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+using namespace std;
+
+
+// Read a greyscale PFM.  PFM rows are stored bottom row first, which
+// is also the order of the G-buffers.
+
+static float *readPFM( char *filename, int &width, int &height )
+
+{
+  FILE *file = fopen( filename, "rb" );
+  if (!file) {
+    cerr << "edges: can't open '" << filename << "'" << endl;
+    exit(1);
+  }
+
+  char magic[3];
+  float scale;
+
+  if (fscanf( file, "%2s %d %d %f", magic, &width, &height, &scale ) != 4 || strcmp( magic, "Pf" ) != 0 ||
+      width <= 0 || height <= 0) {
+    cerr << "edges: '" << filename << "' is not a greyscale PFM file" << endl;
+    exit(1);
+  }
+
+  fgetc( file );		// single whitespace before the data
+
+  int n = width * height;
+  float *depth = new float[ n ];
+
+  if (fread( depth, sizeof(float), n, file ) != (size_t) n) {
+    cerr << "edges: '" << filename << "' is truncated" << endl;
+    exit(1);
+  }
+
+  fclose( file );
+
+  // Negative scale = little endian
+
+  unsigned int one = 1;
+  bool littleEndianHost = (*(unsigned char *) &one == 1);
+
+  if ((scale < 0) != littleEndianHost)
+    for (int i=0; i<n; i++) {
+      unsigned char *b = (unsigned char *) &depth[i];
+      unsigned char t;
+      t = b[0]; b[0] = b[3]; b[3] = t;
+      t = b[1]; b[1] = b[2]; b[2] = t;
+    }
+
+  return depth;
+}
+
+
+// Write the outline: black edges on white, top row first
+
+static void writePGM( char *filename, int width, int height, unsigned char *edges )
+
+{
+  FILE *file = fopen( filename, "wb" );
+  if (!file) {
+    cerr << "edges: can't write '" << filename << "'" << endl;
+    exit(1);
+  }
+
+  fprintf( file, "P5\n%d %d\n255\n", width, height );
+
+  unsigned char *row = new unsigned char[ width ];
+
+  for (int y=height-1; y>=0; y--) {
+    for (int x=0; x<width; x++)
+      row[x] = 255 - edges[ y * width + x ];
+    fwrite( row, 1, width, file );
+  }
+
+  delete [] row;
+  fclose( file );
+}
+
+
+int main( int argc, char **argv )
+
+{
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " in.pfm out.pgm [-radius r] [-laplacian r] [-threshold t] [-threads n] [-bench n]" << endl;
+    exit(1);
+  }
+
+  EdgeOptions options;
+  int numThreads = 0;
+  int benchRuns = 0;
+
+  for (int i=3; i<argc; i++)
+    if (strcmp( argv[i], "-radius" ) == 0 && i+1 < argc)
+      options.dilationRadius = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-laplacian" ) == 0 && i+1 < argc)
+      options.laplacianRadius = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-threshold" ) == 0 && i+1 < argc)
+      options.threshold = atof( argv[++i] );
+    else if (strcmp( argv[i], "-threads" ) == 0 && i+1 < argc)
+      numThreads = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-bench" ) == 0 && i+1 < argc)
+      benchRuns = atoi( argv[++i] );
+    else {
+      cerr << "edges: unknown option '" << argv[i] << "'" << endl;
+      exit(1);
+    }
+
+  if (options.dilationRadius < 0 || options.laplacianRadius < 1) {
+    cerr << "edges: the radii must be at least 0 (-radius) and 1 (-laplacian)" << endl;
+    exit(1);
+  }
+
+  int width, height;
+  float *depth = readPFM( argv[1], width, height );
+  unsigned char *edges = new unsigned char[ width * height ];
+
+  ThreadPool *pool = (numThreads == 1 ? NULL : new ThreadPool( numThreads ));
+
+  detectEdges( depth, edges, width, height, options, pool );
+
+  if (benchRuns > 0) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int i=0; i<benchRuns; i++)
+      detectEdges( depth, edges, width, height, options, pool );
+
+    double secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    fprintf( stderr, "%d x %d, %d threads: %.2f ms per image, %.0f Mpixels/s\n",
+	     width, height, (pool ? pool->size() : 1),
+	     1000 * secs / benchRuns, (double) width * height * benchRuns / secs / 1e6 );
+  }
+
+  writePGM( argv[2], width, height, edges );
+
+  delete pool;
+  delete [] edges;
+  delete [] depth;
+
+  return 0;
+}
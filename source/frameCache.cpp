@@ -0,0 +1,53 @@
+// Copy of the last rendered frame
+
+
+#include "frameCache.h"
+
+
+// Copy the window's back buffer into the cache
+
+void FrameCache::store( int windowWidth, int windowHeight )
+
+{
+  if (FBO == 0 || windowWidth != width || windowHeight != height) {
+
+    if (FBO == 0) {
+      glGenFramebuffers( 1, &FBO );
+      glGenRenderbuffers( 1, &colourBuffer );
+    }
+
+    width = windowWidth;
+    height = windowHeight;
+
+    glBindRenderbuffer( GL_RENDERBUFFER, colourBuffer );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+
+    GLState::bindFramebuffer( GL_FRAMEBUFFER, FBO );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer );
+  }
+
+  GLState::bindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+  glReadBuffer( GL_BACK );
+  GLState::bindFramebuffer( GL_DRAW_FRAMEBUFFER, FBO );
+
+  glBlitFramebuffer( 0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST );
+
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+  valid = true;
+}
+
+
+// Copy the cached frame into the window's back buffer
+
+void FrameCache::present()
+
+{
+  GLState::bindFramebuffer( GL_READ_FRAMEBUFFER, FBO );
+  glReadBuffer( GL_COLOR_ATTACHMENT0 );
+  GLState::bindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
+
+  glBlitFramebuffer( 0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST );
+
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, 0 );
+}
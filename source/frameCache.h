@@ -0,0 +1,41 @@
+// Copy of the last rendered frame
+//
+// Holds the window's image, without the status text, so that an
+// unchanged frame can be shown again without rendering it.
+
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+
+#include "headers.h"
+#include "glState.h"
+
+
+class FrameCache {
+
+  GLuint FBO, colourBuffer;
+  int    width, height;
+
+ public:
+
+  bool valid;			// holds the frame of the current view
+
+  FrameCache() {
+    FBO = colourBuffer = 0;
+    width = height = 0;
+    valid = false;
+  }
+
+  ~FrameCache() {
+    if (FBO != 0) {
+      glDeleteFramebuffers( 1, &FBO );
+      glDeleteRenderbuffers( 1, &colourBuffer );
+      GLState::forget();
+    }
+  }
+
+  void store( int windowWidth, int windowHeight );
+  void present();
+};
+
+#endif
@@ -0,0 +1,184 @@
+// Frame pacing
+
+
+#include "headers.h"
+#include "frameScheduler.h"
+
+#include <thread>
+
+#ifdef LINUX
+#include <GL/glx.h>
+#endif
+
+
+// Set the swap interval of the current context (0 = don't wait for
+// the retrace).  Returns false if the driver has no way to.
+
+static bool setSwapInterval( int interval )
+
+{
+#ifdef LINUX
+  typedef void (*SwapIntervalEXT)( Display *, GLXDrawable, int );
+  typedef int  (*SwapIntervalMESA)( unsigned int );
+  typedef int  (*SwapIntervalSGI)( int );
+
+  SwapIntervalEXT ext = (SwapIntervalEXT) glXGetProcAddressARB( (const GLubyte *) "glXSwapIntervalEXT" );
+  if (ext != NULL && glXGetCurrentDrawable() != 0) {
+    ext( glXGetCurrentDisplay(), glXGetCurrentDrawable(), interval );
+    return true;
+  }
+
+  SwapIntervalMESA mesa = (SwapIntervalMESA) glXGetProcAddressARB( (const GLubyte *) "glXSwapIntervalMESA" );
+  if (mesa != NULL)
+    return mesa( interval ) == 0;
+
+  // The SGI version can't turn the retrace wait off
+
+  SwapIntervalSGI sgi = (SwapIntervalSGI) glXGetProcAddressARB( (const GLubyte *) "glXSwapIntervalSGI" );
+  if (sgi != NULL && interval > 0)
+    return sgi( interval ) == 0;
+#endif
+
+  return false;
+}
+
+
+FrameScheduler::FrameScheduler()
+
+{
+  startTime = Clock::now();
+  nextPresent = startTime;
+  frameStart = startTime;
+
+  frameCost = 0;
+  oversleep = 0.001;
+
+  framesThisSecond = 0;
+  secondStart = 0;
+  fps = 0;
+
+  setMode( TARGET_FPS, 60 );
+}
+
+
+void FrameScheduler::setMode( Mode m, double newFPS )
+
+{
+  mode = m;
+  if (newFPS > 0)
+    targetFPS = newFPS;
+
+  swapIntervalSet = false;	// done in the next frame, when a context is current
+  nextPresent = Clock::now();
+}
+
+
+void FrameScheduler::nextMode()
+
+{
+  setMode( (Mode) ((mode+1) % NUM_MODES), targetFPS );
+}
+
+
+// Sleep until a little before t, then spin.  The spin time follows
+// how late the sleeps have been waking up.
+
+void FrameScheduler::sleepUntil( Clock::time_point t )
+
+{
+  std::chrono::duration<double> margin( 1.5 * oversleep );
+
+  Clock::time_point wake = t - std::chrono::duration_cast<Clock::duration>( margin );
+  Clock::time_point now = Clock::now();
+
+  if (wake > now) {
+    std::this_thread::sleep_until( wake );
+
+    double late = std::chrono::duration<double>( Clock::now() - wake ).count();
+
+    if (late < 0)
+      late = 0;
+    if (late > 0.004)		// a hiccup rather than the usual timer slack
+      late = 0.004;
+
+    oversleep = 0.9 * oversleep + 0.1 * late;
+  }
+
+  while (Clock::now() < t)
+    std::this_thread::yield();
+}
+
+
+void FrameScheduler::waitForNextFrame()
+
+{
+  if (mode != TARGET_FPS)
+    return;
+
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( 1.0 / targetFPS ) );
+  Clock::duration cost   = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( frameCost ) );
+
+  Clock::time_point now = Clock::now();
+
+  // Fell behind: start again from now rather than rushing to catch up
+
+  if (nextPresent + period < now + cost)
+    nextPresent = now + cost;
+  else
+    nextPresent += period;
+
+  sleepUntil( nextPresent - cost );
+}
+
+
+void FrameScheduler::frameStarted()
+
+{
+  if (!swapIntervalSet) {
+    if (!setSwapInterval( mode == VSYNC ? 1 : 0 ) && mode == VSYNC)
+      cerr << "FrameScheduler: can't set the swap interval, so no vsync" << endl;
+    swapIntervalSet = true;
+  }
+
+  frameStart = Clock::now();
+}
+
+
+void FrameScheduler::frameFinished()
+
+{
+  Clock::time_point now = Clock::now();
+
+  double cost = std::chrono::duration<double>( now - frameStart ).count();
+
+  frameCost = (frameCost == 0 ? cost : 0.9 * frameCost + 0.1 * cost);
+
+  // Frame rate over about a second
+
+  framesThisSecond++;
+
+  double t = since( now );
+
+  if (t - secondStart >= 1.0) {
+    fps = framesThisSecond / (t - secondStart);
+    framesThisSecond = 0;
+    secondStart = t;
+  }
+}
+
+
+void FrameScheduler::makeStatusMessage( char *buffer )
+
+{
+  switch (mode) {
+  case TARGET_FPS:
+    sprintf( buffer, "%.0f fps (target %.0f)", fps, targetFPS );
+    break;
+  case VSYNC:
+    sprintf( buffer, "%.0f fps (vsync)", fps );
+    break;
+  default:
+    sprintf( buffer, "%.0f fps (uncapped)", fps );
+    break;
+  }
+}
@@ -0,0 +1,90 @@
+/* frameScheduler.h
+ *
+ * Decides when the next frame starts.
+ *
+ *   TARGET_FPS   Frames are presented every 1/fps seconds.  Each frame
+ *                starts as late as its measured cost allows, so its
+ *                input is fresh; the wait is a sleep followed by a
+ *                short spin, with the spin as long as the sleeps have
+ *                been seen to overshoot.
+ *   VSYNC        Swaps wait for the display's vertical retrace.
+ *   UNCAPPED     Frames run back to back (for benchmarks).
+ *
+ * Times are from std::chrono::steady_clock.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     setMode( m, fps )          Change the mode (fps is for TARGET_FPS)
+ *     waitForNextFrame()         Call before requesting a frame
+ *     frameStarted()             Call at the start and end of drawing
+ *     frameFinished()            a frame, to measure its cost
+ *     seconds()                  Time since the scheduler was created
+ *     measuredFPS()              Frames per second over the last second
+ *     makeStatusMessage( buf )
+ */
+
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <chrono>
+
+
+class FrameScheduler {
+
+  typedef std::chrono::steady_clock Clock;
+
+ public:
+
+  enum Mode { TARGET_FPS, VSYNC, UNCAPPED, NUM_MODES };
+
+ private:
+
+  Mode   mode;
+  double targetFPS;
+  bool   swapIntervalSet;	// swap interval matches the mode
+
+  Clock::time_point startTime;
+  Clock::time_point nextPresent; // when the next frame should be shown
+  Clock::time_point frameStart;
+
+  double frameCost;		// running average of a frame's drawing time (s)
+  double oversleep;		// running average of how late sleeps wake (s)
+
+  int    framesThisSecond;
+  double secondStart;
+  double fps;
+
+  double since( Clock::time_point t ) {
+    return std::chrono::duration<double>( t - startTime ).count();
+  }
+
+  void sleepUntil( Clock::time_point t );
+
+ public:
+
+  FrameScheduler();
+
+  void setMode( Mode m, double fps = 60 );
+  void nextMode();
+
+  Mode getMode() {
+    return mode;
+  }
+
+  void waitForNextFrame();
+  void frameStarted();
+  void frameFinished();
+
+  double seconds() {
+    return since( Clock::now() );
+  }
+
+  double measuredFPS() {
+    return fps;
+  }
+
+  void makeStatusMessage( char *buffer );
+};
+
+#endif
@@ -0,0 +1,155 @@
+// Headless OpenGL context
+
+
+#include "headers.h"
+#include "glContext.h"
+
+#include <EGL/eglext.h>
+#include <mutex>
+
+
+// All contexts share one EGL display, which is opened on first use.
+// The Mesa "surfaceless" platform is preferred since it needs neither
+// an X server nor a GPU device; otherwise fall back to the default
+// display.
+
+static std::mutex eglLock;
+static EGLDisplay sharedDisplay = EGL_NO_DISPLAY;
+
+
+static EGLDisplay openDisplay()
+
+{
+  std::lock_guard<std::mutex> guard( eglLock );
+
+  if (sharedDisplay != EGL_NO_DISPLAY)
+    return sharedDisplay;
+
+  EGLDisplay display = EGL_NO_DISPLAY;
+
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay
+    = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+
+  if (getPlatformDisplay != NULL)
+    display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+  EGLint major, minor;
+
+  if (display == EGL_NO_DISPLAY || !eglInitialize( display, &major, &minor )) {
+    cerr << "GLContext: can't open an EGL display" << endl;
+    return EGL_NO_DISPLAY;
+  }
+
+  sharedDisplay = display;
+  return sharedDisplay;
+}
+
+
+GLContext::GLContext()
+
+{
+  display = EGL_NO_DISPLAY;
+  context = EGL_NO_CONTEXT;
+}
+
+
+GLContext::~GLContext()
+
+{
+  if (context != EGL_NO_CONTEXT) {
+    release();
+    eglDestroyContext( display, context );
+  }
+}
+
+
+bool GLContext::create()
+
+{
+  display = openDisplay();
+  if (display == EGL_NO_DISPLAY)
+    return false;
+
+  // The API binding is per-thread, so do this on every thread that
+  // creates a context
+
+  eglBindAPI( EGL_OPENGL_API );
+
+  const EGLint configAttribs[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+
+  EGLConfig config;
+  EGLint    numConfigs = 0;
+
+  if (!eglChooseConfig( display, configAttribs, &config, 1, &numConfigs ) || numConfigs == 0) {
+    cerr << "GLContext: no EGL config supports desktop OpenGL" << endl;
+    return false;
+  }
+
+  // A compatibility context, like the one GLUT creates, so that the
+  // same shaders and GPUProgram code work in both
+
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+    EGL_NONE
+  };
+
+  context = eglCreateContext( display, config, EGL_NO_CONTEXT, contextAttribs );
+
+  if (context == EGL_NO_CONTEXT) {
+    cerr << "GLContext: can't create an OpenGL 3.3 context (EGL error 0x" << hex << eglGetError() << dec << ")" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+bool GLContext::makeCurrent()
+
+{
+  eglBindAPI( EGL_OPENGL_API );
+
+  if (!eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context )) {
+    cerr << "GLContext: eglMakeCurrent failed (EGL error 0x" << hex << eglGetError() << dec << ")" << endl;
+    return false;
+  }
+
+  // GLEW keeps its function pointers in globals, so initialize it
+  // under the lock.  The pointers are the same for every context of
+  // the same driver.  A GLX-built GLEW reports that there is no X
+  // display, but has loaded the core functions by then.
+
+  std::lock_guard<std::mutex> guard( eglLock );
+
+  glewExperimental = GL_TRUE;
+  GLenum status = glewInit();
+
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  if (status == GLEW_ERROR_NO_GLX_DISPLAY)
+    status = GLEW_OK;
+#endif
+
+  if (status != GLEW_OK) {
+    cerr << "GLContext: " << glewGetErrorString( status ) << endl;
+    return false;
+  }
+
+  glGetError();			// glewInit can leave a spurious error behind
+
+  return true;
+}
+
+
+void GLContext::release()
+
+{
+  eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+}
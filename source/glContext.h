@@ -0,0 +1,29 @@
+// Headless OpenGL context
+//
+// An EGL context with no window or surface.  Anything drawn must go
+// to a framebuffer object.  A context is current on at most one
+// thread at a time, so each rendering thread creates its own.
+
+#ifndef GLCONTEXT_H
+#define GLCONTEXT_H
+
+
+#include <EGL/egl.h>
+
+
+class GLContext {
+
+  EGLDisplay display;
+  EGLContext context;
+
+ public:
+
+  GLContext();
+  ~GLContext();
+
+  bool create();		// create the context; false on failure
+  bool makeCurrent();		// bind to the calling thread (and init GLEW)
+  void release();		// unbind from the calling thread
+};
+
+#endif
@@ -0,0 +1,150 @@
+// Shadow copy of OpenGL state
+
+
+#include "glState.h"
+
+
+thread_local GLuint GLState::caps[ NUM_CAPS ];
+thread_local GLuint GLState::drawFramebuffer;
+thread_local GLuint GLState::readFramebuffer;
+thread_local GLuint GLState::activeUnit;
+thread_local GLuint GLState::textures[ MAX_UNITS ];
+thread_local GLuint GLState::arrayTextures[ MAX_UNITS ];
+thread_local GLuint GLState::program;
+thread_local GLint  GLState::viewportRect[4];
+thread_local bool   GLState::viewportKnown;
+
+thread_local int GLState::numIssued;
+thread_local int GLState::numSkipped;
+
+
+// Index of a tracked capability in 'caps', or -1
+
+int GLState::capIndex( GLenum cap )
+
+{
+  switch (cap) {
+  case GL_DEPTH_TEST:   return DEPTH_TEST_CAP;
+  case GL_STENCIL_TEST: return STENCIL_TEST_CAP;
+  case GL_BLEND:        return BLEND_CAP;
+  case GL_CULL_FACE:    return CULL_FACE_CAP;
+  case GL_SCISSOR_TEST: return SCISSOR_TEST_CAP;
+  default:              return -1;
+  }
+}
+
+
+void GLState::setCap( GLenum cap, bool on )
+
+{
+  int i = capIndex( cap );
+
+  if (i >= 0 && !change( caps[i], on ))
+    return;
+
+  if (i < 0)
+    numIssued++;
+
+  if (on)
+    glEnable( cap );
+  else
+    glDisable( cap );
+}
+
+
+// GL_FRAMEBUFFER binds both the draw and read framebuffers
+
+void GLState::bindFramebuffer( GLenum target, GLuint fbo )
+
+{
+  if (target == GL_FRAMEBUFFER) {
+
+    if (drawFramebuffer == fbo+1 && readFramebuffer == fbo+1) {
+      numSkipped++;
+      return;
+    }
+
+    drawFramebuffer = readFramebuffer = fbo+1;
+    numIssued++;
+
+  } else if (!change( target == GL_READ_FRAMEBUFFER ? readFramebuffer : drawFramebuffer, fbo ))
+    return;
+
+  glBindFramebuffer( target, fbo );
+}
+
+
+// GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings of a unit are kept
+// apart, as they are in OpenGL
+
+void GLState::bindTexture( int unit, GLuint texture, GLenum target )
+
+{
+  if (unit >= MAX_UNITS) {
+    glActiveTexture( GL_TEXTURE0 + unit );
+    glBindTexture( target, texture );
+    numIssued += 2;
+    activeUnit = 0;		// unknown
+    return;
+  }
+
+  GLuint &shadow = (target == GL_TEXTURE_2D_ARRAY ? arrayTextures[unit] : textures[unit]);
+
+  if (shadow == texture+1) {
+    numSkipped++;
+    return;
+  }
+
+  if (change( activeUnit, unit ))
+    glActiveTexture( GL_TEXTURE0 + unit );
+
+  shadow = texture+1;
+  numIssued++;
+
+  glBindTexture( target, texture );
+}
+
+
+void GLState::useProgram( GLuint prog )
+
+{
+  if (change( program, prog ))
+    glUseProgram( prog );
+}
+
+
+void GLState::viewport( GLint x, GLint y, GLsizei width, GLsizei height )
+
+{
+  if (viewportKnown && viewportRect[0] == x && viewportRect[1] == y &&
+      viewportRect[2] == width && viewportRect[3] == height) {
+    numSkipped++;
+    return;
+  }
+
+  viewportRect[0] = x;
+  viewportRect[1] = y;
+  viewportRect[2] = width;
+  viewportRect[3] = height;
+  viewportKnown = true;
+  numIssued++;
+
+  glViewport( x, y, width, height );
+}
+
+
+void GLState::forget()
+
+{
+  for (int i=0; i<NUM_CAPS; i++)
+    caps[i] = 0;
+
+  drawFramebuffer = readFramebuffer = 0;
+  activeUnit = 0;
+
+  for (int i=0; i<MAX_UNITS; i++)
+    textures[i] = arrayTextures[i] = 0;
+
+  program = 0;
+  viewportKnown = false;
+}
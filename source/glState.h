@@ -0,0 +1,104 @@
+/* glState.h
+ *
+ * Shadow copy of the OpenGL state that the renderer changes most:
+ * the enabled capabilities, the framebuffer bindings, the texture on
+ * each unit, the program in use, and the viewport.  A call that would
+ * set the state to what it already is doesn't reach the driver.
+ *
+ * The calls made and skipped are counted from beginFrame(), to show
+ * how many the cache saves.
+ *
+ * The copy is per thread, as each thread that renders has its own
+ * context (see batch.cpp).  State starts out unknown, so the first
+ * call for each part of it is always made.  Code that changes this
+ * state with direct GL calls must call forget() afterwards.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     GLState::enable( cap ), disable( cap )
+ *     GLState::bindFramebuffer( target, fbo )
+ *     GLState::bindTexture( unit, texture )    GL_TEXTURE_2D on unit
+ *     GLState::bindTexture( unit, texture, GL_TEXTURE_2D_ARRAY )
+ *     GLState::useProgram( program )
+ *     GLState::viewport( x, y, width, height )
+ *     GLState::forget()                        Make the state unknown
+ *     GLState::beginFrame()                    Reset the counts
+ *     GLState::issued(), GLState::skipped()    Calls since beginFrame()
+ */
+
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "headers.h"
+
+
+class GLState {
+
+  enum { MAX_UNITS = 32 };
+
+  enum { DEPTH_TEST_CAP,	// capabilities that are tracked
+	 STENCIL_TEST_CAP,
+	 BLEND_CAP,
+	 CULL_FACE_CAP,
+	 SCISSOR_TEST_CAP,
+	 NUM_CAPS };
+
+  // Each value is stored plus one, so that 0 (which a new thread
+  // starts with) means unknown
+
+  static thread_local GLuint caps[ NUM_CAPS ];
+  static thread_local GLuint drawFramebuffer, readFramebuffer;
+  static thread_local GLuint activeUnit;
+  static thread_local GLuint textures[ MAX_UNITS ];
+  static thread_local GLuint arrayTextures[ MAX_UNITS ];
+  static thread_local GLuint program;
+  static thread_local GLint  viewportRect[4];
+  static thread_local bool   viewportKnown;
+
+  static thread_local int numIssued, numSkipped;
+
+  static int  capIndex( GLenum cap );
+  static void setCap( GLenum cap, bool on );
+
+  static bool change( GLuint &shadow, GLuint value ) {
+    if (shadow == value+1) {
+      numSkipped++;
+      return false;
+    }
+    shadow = value+1;
+    numIssued++;
+    return true;
+  }
+
+ public:
+
+  static void enable( GLenum cap ) {
+    setCap( cap, true );
+  }
+
+  static void disable( GLenum cap ) {
+    setCap( cap, false );
+  }
+
+  static void bindFramebuffer( GLenum target, GLuint fbo );
+  static void bindTexture( int unit, GLuint texture, GLenum target = GL_TEXTURE_2D );
+  static void useProgram( GLuint prog );
+  static void viewport( GLint x, GLint y, GLsizei width, GLsizei height );
+
+  static void forget();
+
+  static void beginFrame() {
+    numIssued = numSkipped = 0;
+  }
+
+  static int issued() {
+    return numIssued;
+  }
+
+  static int skipped() {
+    return numSkipped;
+  }
+};
+
+#endif
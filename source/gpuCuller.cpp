@@ -0,0 +1,310 @@
+// Culling of instances on the GPU
+
+
+#include "gpuCuller.h"
+#include "profiler.h"
+
+
+#define WORKGROUP_SIZE     64	// as in cull.comp
+#define PYRAMID_TILE_SIZE   8	// as in depthPyramid.comp
+#define MAX_WORKGROUPS  65535	// in one dimension, as OpenGL guarantees
+
+
+GPUCuller::GPUCuller()
+
+{
+  cullProg = new GPUProgram( "shaders/cull.comp" );
+  pyramidProg = new GPUProgram( "shaders/depthPyramid.comp" );
+
+  model = NULL;
+  numDraws = numInstances = 0;
+  fits = false;
+
+  glGenBuffers( 1, &boundsBuffer );
+  glGenBuffers( 1, &transformBuffer );
+  glGenBuffers( 1, &templateBuffer );
+  glGenBuffers( 1, &commandBuffer );
+  glGenBuffers( 1, &visibleBuffer );
+  glGenBuffers( 1, &occludedBuffer );
+
+  pyramid = 0;
+  pyramidWidth = pyramidHeight = pyramidLevels = 0;
+  pyramidValid = false;
+  occlusionTested = false;
+
+  useOcclusion = true;
+}
+
+
+GPUCuller::~GPUCuller()
+
+{
+  glDeleteBuffers( 1, &boundsBuffer );
+  glDeleteBuffers( 1, &transformBuffer );
+  glDeleteBuffers( 1, &templateBuffer );
+  glDeleteBuffers( 1, &commandBuffer );
+  glDeleteBuffers( 1, &visibleBuffer );
+  glDeleteBuffers( 1, &occludedBuffer );
+
+  if (pyramid != 0)
+    glDeleteTextures( 1, &pyramid );
+
+  GLState::forget();
+
+  delete pyramidProg;
+  delete cullProg;
+}
+
+
+// Copy a model's group bounds, instance transforms, and draw commands
+// to the GPU.  Group d's visible transforms go at d*numInstances.
+
+void GPUCuller::storeModel( wfModel *obj )
+
+{
+  PROFILE_ZONE( "GPUCuller::storeModel" );
+
+  model = obj;
+  modelInstancesID = obj->instancesID;
+  numDraws = obj->numDraws;
+  numInstances = obj->numInstances;
+
+  fits = ((double) numDraws * numInstances * sizeof(mat4) <= MAX_VISIBLE_BYTES);
+
+  if (!fits) {
+    cerr << "GPUCuller: " << numDraws << " draws x " << numInstances
+	 << " instances is too many to cull on the GPU; culling on the CPU" << endl;
+    return;
+  }
+
+  vec4          *bounds   = new vec4[ numDraws ];
+  wfDrawCommand *commands = new wfDrawCommand[ numDraws ];
+
+  for (int d=0; d<numDraws; d++) {
+
+    wfBounds &b = obj->drawBounds[d];
+
+    bounds[d] = vec4( b.centre.x, b.centre.y, b.centre.z, b.radius );
+
+    commands[d] = obj->drawCommands[d];
+    commands[d].instanceCount = 0;
+    commands[d].baseInstance = d * numInstances;
+  }
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, boundsBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numDraws * sizeof(vec4), bounds, GL_STATIC_DRAW );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, transformBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numInstances * sizeof(mat4), obj->instanceTransforms, GL_STATIC_DRAW );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, templateBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numDraws * sizeof(wfDrawCommand), commands, GL_STATIC_DRAW );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, commandBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numDraws * sizeof(wfDrawCommand), NULL, GL_DYNAMIC_COPY );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, visibleBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numDraws * numInstances * sizeof(mat4), NULL, GL_DYNAMIC_COPY );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, occludedBuffer );
+  glBufferData( GL_SHADER_STORAGE_BUFFER, numDraws * numInstances * sizeof(GLuint), NULL, GL_DYNAMIC_COPY );
+
+  glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+  delete [] bounds;
+  delete [] commands;
+
+  // The last frame's depth was of something else
+
+  pyramidValid = false;
+}
+
+
+// Fill the command and visible transform buffers for drawing obj
+// with MVP.  Returns false if obj is to be culled on the CPU instead.
+
+bool GPUCuller::cull( wfModel *obj, mat4 &MVP )
+
+{
+  PROFILE_ZONE( "GPUCuller::cull" );
+
+  if (obj != model || obj->instancesID != modelInstancesID)
+    storeModel( obj );
+
+  if (!fits)
+    return false;
+
+  occlusionTested = (useOcclusion && pyramidValid);
+
+  if (numDraws > 0)
+    dispatch( MVP, false, occlusionTested );
+
+  return true;
+}
+
+
+// Build the pyramid from this frame's depth so far, and refill the
+// command and visible transform buffers with the instances that the
+// last frame's pyramid hid but this one doesn't.  Returns false if
+// there are none to draw.
+
+bool GPUCuller::recheck( GLuint depthTexture, int width, int height, mat4 &MVP )
+
+{
+  PROFILE_ZONE( "GPUCuller::recheck" );
+
+  if (!useOcclusion)
+    return false;
+
+  buildDepthPyramid( depthTexture, width, height );
+
+  if (!occlusionTested || numDraws == 0)
+    return false;
+
+  dispatch( MVP, true, true );
+
+  return true;
+}
+
+
+// Run the culling shader over every (draw, instance) pair.  Each draw
+// starts with no instances.
+
+void GPUCuller::dispatch( mat4 &MVP, bool recheckOccluded, bool occlusion )
+
+{
+  glBindBuffer( GL_COPY_READ_BUFFER, templateBuffer );
+  glBindBuffer( GL_COPY_WRITE_BUFFER, commandBuffer );
+  glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numDraws * sizeof(wfDrawCommand) );
+  glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+  glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+  vec4 planes[6];
+  frustumPlanes( MVP, planes );
+
+  cullProg->activate();
+
+  cullProg->setMat4(  "MVP",          MVP );
+  cullProg->setVec4s( "planes",       6, planes );
+  cullProg->setUint(  "numDraws",     numDraws );
+  cullProg->setUint(  "numInstances", numInstances );
+
+  cullProg->setInt( "recheck",         recheckOccluded );
+  cullProg->setInt( "useDepthPyramid", occlusion );
+
+  if (occlusion) {
+    GLState::bindTexture( PYRAMID_UNIT, pyramid );
+    cullProg->setInt( "depthPyramid", PYRAMID_UNIT );
+    cullProg->setInt( "pyramidLevels", pyramidLevels );
+    cullProg->setVec2( "pyramidSize", vec2( pyramidWidth, pyramidHeight ) );
+  }
+
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, boundsBuffer );
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, transformBuffer );
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, commandBuffer );
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 3, visibleBuffer );
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 4, occludedBuffer );
+
+  // One invocation per (draw, instance), in rows of at most
+  // MAX_WORKGROUPS workgroups
+
+  unsigned int numGroups = (numDraws * numInstances + WORKGROUP_SIZE-1) / WORKGROUP_SIZE;
+
+  if (numGroups <= MAX_WORKGROUPS)
+    glDispatchCompute( numGroups, 1, 1 );
+  else
+    glDispatchCompute( MAX_WORKGROUPS, (numGroups + MAX_WORKGROUPS-1) / MAX_WORKGROUPS, 1 );
+
+  // The results are read as draw commands and vertex attributes, and
+  // the occluded flags by the recheck
+
+  glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT );
+
+  for (int i=0; i<5; i++)
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, i, 0 );
+
+  cullProg->deactivate();
+}
+
+
+void GPUCuller::draw( wfModel *obj, GPUProgram *gpuProg )
+
+{
+  obj->drawIndirect( gpuProg, commandBuffer, visibleBuffer );
+}
+
+
+// Make a pyramid of farthest depths from the depth texture.  The base
+// level is the depth buffer stretched to a power-of-two size, so that
+// each level halves the one below exactly.
+
+void GPUCuller::buildDepthPyramid( GLuint depthTexture, int width, int height )
+
+{
+  PROFILE_ZONE( "GPUCuller::buildDepthPyramid" );
+
+  int w = 1, h = 1;
+  while (w < width)
+    w *= 2;
+  while (h < height)
+    h *= 2;
+
+  if (w != pyramidWidth || h != pyramidHeight) {
+
+    if (pyramid != 0) {
+      glDeleteTextures( 1, &pyramid );
+      GLState::forget();
+    }
+
+    pyramidWidth = w;
+    pyramidHeight = h;
+
+    pyramidLevels = 1;
+    while (w > 1 || h > 1) {
+      w = (w > 1 ? w/2 : 1);
+      h = (h > 1 ? h/2 : 1);
+      pyramidLevels++;
+    }
+
+    glGenTextures( 1, &pyramid );
+    GLState::bindTexture( PYRAMID_UNIT, pyramid );
+    glTexStorage2D( GL_TEXTURE_2D, pyramidLevels, GL_R32F, pyramidWidth, pyramidHeight );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+  }
+
+  pyramidProg->activate();
+  pyramidProg->setInt( "source", PYRAMID_UNIT );
+
+  // Each level from the one below (or, for the base, the depth buffer)
+
+  w = pyramidWidth;
+  h = pyramidHeight;
+
+  for (int level=0; level<pyramidLevels; level++) {
+
+    if (level == 0) {
+      GLState::bindTexture( PYRAMID_UNIT, depthTexture );
+      pyramidProg->setInt( "sourceLevel", 0 );
+      glUniform2i( glGetUniformLocation( pyramidProg->id(), "sourceSize" ), width, height );
+    } else {
+      GLState::bindTexture( PYRAMID_UNIT, pyramid );
+      pyramidProg->setInt( "sourceLevel", level-1 );
+      glUniform2i( glGetUniformLocation( pyramidProg->id(), "sourceSize" ), w, h );
+      w = (w > 1 ? w/2 : 1);
+      h = (h > 1 ? h/2 : 1);
+    }
+
+    glBindImageTexture( 0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+
+    glDispatchCompute( (w + PYRAMID_TILE_SIZE-1) / PYRAMID_TILE_SIZE, (h + PYRAMID_TILE_SIZE-1) / PYRAMID_TILE_SIZE, 1 );
+
+    glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+  }
+
+  glBindImageTexture( 0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+
+  pyramidProg->deactivate();
+
+  pyramidValid = true;
+}
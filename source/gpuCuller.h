@@ -0,0 +1,100 @@
+/* gpuCuller.h
+ *
+ * Culling of a model's instances on the GPU.
+ *
+ * A compute shader tests each (group, instance) pair of the model
+ * against the view frustum and against a depth pyramid (Hi-Z) built
+ * from the previous frame's depth buffer.  The transforms of the
+ * pairs that survive are appended to their group's draw command,
+ * which wfModel::drawIndirect() then draws.  The CPU does the same
+ * work per frame however many instances there are.
+ *
+ * Last frame's depth may hide something that this frame's view
+ * uncovers, so culling has two phases.  After the first phase's
+ * instances are drawn, recheck() builds the pyramid from this frame's
+ * depth and tests again just the pairs that the old pyramid hid; the
+ * ones now visible are drawn too.  So each frame is complete by
+ * itself, as a one-shot render (batch.cpp) needs.  The pyramid is
+ * then next frame's first phase occluders.
+ *
+ * Each group has room for all instances in the buffer of visible
+ * transforms.  Models for which that would take more than
+ * MAX_VISIBLE_BYTES are left to the CPU (cull() returns false).
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     GPUCuller::supported()         OpenGL has what this needs (4.3)
+ *     cull( obj, MVP )               Find the instances that MVP can see
+ *     draw( obj, gpuProg )           Draw them
+ *     recheck( depthTexture, width, height, MVP )
+ *                                    Build the pyramid from the depth
+ *                                    drawn so far and find the hidden
+ *                                    instances that it shows, to be
+ *                                    drawn with draw().  Returns false
+ *                                    if there is nothing to draw.
+ *     forgetDepth()                  Stop occlusion tests until the
+ *                                    next recheck()
+ */
+
+
+#ifndef GPUCULLER_H
+#define GPUCULLER_H
+
+#include "headers.h"
+#include "wavefront.h"
+#include "gpuProgram.h"
+#include "glState.h"
+
+
+class GPUCuller {
+
+  enum { PYRAMID_UNIT = 7 };	// texture unit for the depth pyramid
+  enum { MAX_VISIBLE_BYTES = 256 << 20 };
+
+  GPUProgram *cullProg, *pyramidProg;
+
+  // The model whose bounds and instances are in the buffers
+
+  wfModel     *model;
+  unsigned int modelInstancesID;
+  int          numDraws, numInstances;
+  bool         fits;		// visible transforms fit in MAX_VISIBLE_BYTES
+
+  GLuint boundsBuffer;		// per draw: group centre and radius
+  GLuint transformBuffer;	// all instance transforms
+  GLuint templateBuffer;	// per draw: its command, with no instances
+  GLuint commandBuffer;		// per draw: its command, with the visible instances
+  GLuint visibleBuffer;		// per draw: room for all the instance transforms
+  GLuint occludedBuffer;	// per (draw, instance): hidden by the pyramid
+
+  GLuint pyramid;		// farthest depth, with a power-of-two base level
+  int    pyramidWidth, pyramidHeight, pyramidLevels;
+  bool   pyramidValid;
+  bool   occlusionTested;	// the first phase used the pyramid
+
+  void storeModel( wfModel *obj );
+  void dispatch( mat4 &MVP, bool recheckOccluded, bool occlusion );
+  void buildDepthPyramid( GLuint depthTexture, int width, int height );
+
+ public:
+
+  bool useOcclusion;		// test against the depth pyramid, not just the frustum
+
+  static bool supported() {
+    return GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object &&
+      GLEW_ARB_shader_image_load_store && GLEW_ARB_texture_storage && GLEW_ARB_multi_draw_indirect;
+  }
+
+  GPUCuller();
+  ~GPUCuller();
+
+  bool cull( wfModel *obj, mat4 &MVP );
+  void draw( wfModel *obj, GPUProgram *gpuProg );
+  bool recheck( GLuint depthTexture, int width, int height, mat4 &MVP );
+
+  void forgetDepth() {
+    pyramidValid = false;
+  }
+};
+
+#endif
@@ -83,6 +83,8 @@ void GPUProgram::init( char *vsText, char *fsText )
 {
   glErrorReport( "before GPUProgram::init" );
 
+  shader_cp = 0;
+
   // Vertex shader
 
   shader_vp = glCreateShader(GL_VERTEX_SHADER);
@@ -107,3 +109,22 @@ void GPUProgram::init( char *vsText, char *fsText )
 
   glErrorReport( "after GPUProgram::init" );
 }
+
+
+void GPUProgram::initCompute( char *csText )
+
+{
+  glErrorReport( "before GPUProgram::initCompute" );
+
+  shader_cp = glCreateShader( GL_COMPUTE_SHADER );
+  glShaderSource( shader_cp, 1, (const char **) &csText, 0 );
+  glCompileShader( shader_cp );
+  validateShader( shader_cp, "compute shader" );
+
+  program_id = glCreateProgram();
+  glAttachShader( program_id, shader_cp );
+  glLinkProgram( program_id );
+  validateProgram( program_id );
+
+  glErrorReport( "after GPUProgram::initCompute" );
+}
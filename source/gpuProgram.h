@@ -6,6 +6,7 @@
 
 #include "headers.h"
 #include "linalg.h"
+#include "glState.h"
 
 
 class GPUProgram {
@@ -13,11 +14,28 @@ class GPUProgram {
   unsigned int program_id;
   unsigned int shader_vp;
   unsigned int shader_fp;
+  unsigned int shader_cp;	// compute shader, or 0
 
  public:
 
   GPUProgram() {};
 
+  // A compute program (OpenGL 4.3)
+
+  GPUProgram( const char *csFile ) {
+
+    shader_vp = shader_fp = shader_cp = 0;
+
+    char* csText = textFileRead(csFile);
+
+    if (csText == NULL) {
+      std::cerr << "Compute shader file '" << csFile << "' not found." << std::endl;
+      return;
+    }
+
+    initCompute( csText );
+  }
+
   GPUProgram( const char *vsFile, const char *fsFile ) {
     initFromFile( vsFile, fsFile );
   }
@@ -42,27 +60,34 @@ class GPUProgram {
   }
 
   ~GPUProgram() {
-    glDetachShader( program_id, shader_vp );
-    glDeleteShader( shader_vp );
-
-    glDetachShader( program_id, shader_fp );
-    glDeleteShader( shader_fp );
+    if (shader_cp != 0) {
+      glDetachShader( program_id, shader_cp );
+      glDeleteShader( shader_cp );
+    } else {
+      glDetachShader( program_id, shader_vp );
+      glDeleteShader( shader_vp );
+
+      glDetachShader( program_id, shader_fp );
+      glDeleteShader( shader_fp );
+    }
 
     glDeleteProgram( program_id );
+    GLState::forget();
   }
 
   void init( char *vsText, char *fsText );
+  void initCompute( char *csText );
 
   int id() {
     return program_id;
   }
 
   void activate() {
-    glUseProgram( program_id );
+    GLState::useProgram( program_id );
   }
 
   void deactivate() {
-    glUseProgram( 0 );
+    GLState::useProgram( 0 );
   }
 
   void setMat4( char *name, mat4 &M ) {
@@ -89,6 +114,14 @@ class GPUProgram {
     glUniform1i( glGetUniformLocation( program_id, name ), i );
   }
 
+  void setUint( char *name, unsigned int i ) {
+    glUniform1ui( glGetUniformLocation( program_id, name ), i );
+  }
+
+  void setVec4s( char *name, int n, vec4 *v ) {
+    glUniform4fv( glGetUniformLocation( program_id, name ), n, &v[0][0] );
+  }
+
   char* textFileRead(const char *fileName);
 
   void glErrorReport( char *where ) {
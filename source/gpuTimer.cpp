@@ -0,0 +1,156 @@
+// GPU time and pipeline statistics of the render passes
+
+
+#include "gpuTimer.h"
+
+
+static GLenum queryTargets[] = { GL_TIME_ELAPSED,
+				 GL_VERTICES_SUBMITTED_ARB,
+				 GL_PRIMITIVES_SUBMITTED_ARB,
+				 GL_FRAGMENT_SHADER_INVOCATIONS_ARB };
+
+
+GPUTimer::GPUTimer( int nPasses )
+
+{
+  numPasses = (nPasses > MAX_PASSES ? MAX_PASSES : nPasses);
+
+  havePipelineStats = GLEW_ARB_pipeline_statistics_query;
+
+  for (int s=0; s<NUM_FRAMES; s++) {
+    glGenQueries( MAX_PASSES * NUM_QUERIES, &queries[s][0][0] );
+    for (int p=0; p<MAX_PASSES; p++)
+      issued[s][p] = false;
+    frameOf[s] = -1;
+  }
+
+  slot = 0;
+  skipFrame = true;
+  frameNumber = -1;
+  latestFrame = -1;
+  log = NULL;
+}
+
+
+GPUTimer::~GPUTimer()
+
+{
+  for (int s=0; s<NUM_FRAMES; s++)
+    glDeleteQueries( MAX_PASSES * NUM_QUERIES, &queries[s][0][0] );
+
+  if (log != NULL)
+    fclose( log );
+}
+
+
+void GPUTimer::openLog( char *filename )
+
+{
+  if (log != NULL)
+    fclose( log );
+
+  log = fopen( filename, "w" );
+  if (log == NULL) {
+    cerr << "GPUTimer: can't write '" << filename << "'" << endl;
+    return;
+  }
+
+  fprintf( log, "frame,pass,ms,vertices,primitives,fragments\n" );
+}
+
+
+// Read the results of query set s, if the GPU has finished with them.
+// Returns false if it has not.
+
+bool GPUTimer::collect( int s )
+
+{
+  if (frameOf[s] < 0)
+    return true;
+
+  int n = (havePipelineStats ? NUM_QUERIES : 1);
+
+  for (int p=0; p<numPasses; p++)
+    if (issued[s][p])
+      for (int q=0; q<n; q++) {
+	GLuint available;
+	glGetQueryObjectuiv( queries[s][p][q], GL_QUERY_RESULT_AVAILABLE, &available );
+	if (!available)
+	  return false;
+      }
+
+  for (int p=0; p<numPasses; p++) {
+
+    PassStats &st = latest[p];
+
+    st.measured = issued[s][p];
+    st.ms = 0;
+    st.vertices = st.primitives = st.fragments = 0;
+
+    if (issued[s][p]) {
+
+      GLuint64 ns;
+      glGetQueryObjectui64v( queries[s][p][TIME_QUERY], GL_QUERY_RESULT, &ns );
+      st.ms = ns / 1.0e6;
+
+      if (havePipelineStats) {
+	glGetQueryObjectui64v( queries[s][p][VERTICES_QUERY],   GL_QUERY_RESULT, &st.vertices );
+	glGetQueryObjectui64v( queries[s][p][PRIMITIVES_QUERY], GL_QUERY_RESULT, &st.primitives );
+	glGetQueryObjectui64v( queries[s][p][FRAGMENTS_QUERY],  GL_QUERY_RESULT, &st.fragments );
+      }
+
+      if (log != NULL)
+	fprintf( log, "%ld,%d,%.4f,%llu,%llu,%llu\n", frameOf[s], p+1, st.ms,
+		 (unsigned long long) st.vertices, (unsigned long long) st.primitives,
+		 (unsigned long long) st.fragments );
+    }
+
+    issued[s][p] = false;
+  }
+
+  latestFrame = frameOf[s];
+  frameOf[s] = -1;
+
+  return true;
+}
+
+
+void GPUTimer::beginFrame()
+
+{
+  frameNumber++;
+  slot = (slot+1) % NUM_FRAMES;
+
+  skipFrame = !collect( slot );
+
+  if (!skipFrame)
+    frameOf[slot] = frameNumber;
+}
+
+
+void GPUTimer::beginPass( int pass )
+
+{
+  if (skipFrame || pass >= numPasses)
+    return;
+
+  int n = (havePipelineStats ? NUM_QUERIES : 1);
+
+  for (int q=0; q<n; q++)
+    glBeginQuery( queryTargets[q], queries[slot][pass][q] );
+
+  issued[slot][pass] = true;
+}
+
+
+void GPUTimer::endPass( int pass )
+
+{
+  if (skipFrame || pass >= numPasses)
+    return;
+
+  int n = (havePipelineStats ? NUM_QUERIES : 1);
+
+  for (int q=0; q<n; q++)
+    glEndQuery( queryTargets[q] );
+}
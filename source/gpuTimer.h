@@ -0,0 +1,93 @@
+/* gpuTimer.h
+ *
+ * GPU time and pipeline statistics of the render passes.
+ *
+ * Each pass is wrapped in a GL_TIME_ELAPSED query and, if the driver
+ * has ARB_pipeline_statistics_query, in queries counting the vertices,
+ * primitives and fragment shader invocations.  There are NUM_FRAMES
+ * sets of queries used in turn, and a frame's results are only read
+ * when its set comes round again, by which time the GPU has finished
+ * them, so reading never stalls.  If the GPU is further behind than
+ * that, the frame is not measured.
+ *
+ *   CONSTRUCTORS
+ *
+ *     GPUTimer( n )              Time n passes (at most MAX_PASSES)
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     beginFrame()               Collect old results and start a frame
+ *     beginPass( p )             Start measuring pass p of this frame
+ *     endPass( p )               Stop measuring pass p
+ *     stats( p )                 The latest results for pass p
+ *     openLog( filename )        Also write every frame's results to a
+ *                                CSV file
+ */
+
+
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include "headers.h"
+
+
+class PassStats {
+ public:
+  bool     measured;		// false if the pass didn't run in that frame
+  double   ms;
+  GLuint64 vertices, primitives, fragments;
+};
+
+
+class GPUTimer {
+
+ public:
+
+  enum { MAX_PASSES = 4, NUM_FRAMES = 3 };
+
+ private:
+
+  enum { TIME_QUERY, VERTICES_QUERY, PRIMITIVES_QUERY, FRAGMENTS_QUERY, NUM_QUERIES };
+
+  int    numPasses;
+  GLuint queries[NUM_FRAMES][MAX_PASSES][NUM_QUERIES];
+  bool   issued[NUM_FRAMES][MAX_PASSES];
+  long   frameOf[NUM_FRAMES];	// frame number measured by each set
+
+  int  slot;			// set of queries for this frame
+  bool skipFrame;		// set still busy, so don't measure this frame
+  long frameNumber;
+  bool havePipelineStats;
+
+  PassStats latest[MAX_PASSES];
+  long      latestFrame;	// frame that 'latest' comes from (-1 = none)
+
+  FILE *log;
+
+  bool collect( int s );
+
+ public:
+
+  GPUTimer( int nPasses );
+  ~GPUTimer();
+
+  void beginFrame();
+  void beginPass( int pass );
+  void endPass( int pass );
+
+  bool hasResults() {
+    return latestFrame >= 0;
+  }
+
+  bool hasPipelineStats() {
+    return havePipelineStats;
+  }
+
+  PassStats &stats( int pass ) {
+    return latest[pass];
+  }
+
+  void openLog( char *filename );
+};
+
+#endif
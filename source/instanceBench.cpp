@@ -0,0 +1,173 @@
+// Instancing benchmark
+//
+// Usage: shader -instbench model.obj [-size WxH] [-max n] [-maxseparate n] [-seconds s]
+//
+// Renders a grid of 1, 10, 100, ... copies of the model, up to -max
+// (default 100000), in a headless context.  Each count is drawn both
+// with instancing (one multi-draw for all copies) and, up to
+// -maxseparate copies (default 10000), with one draw call and set of
+// uniforms per copy.  Each measurement renders frames for -seconds
+// (default 1) and waits for the GPU to finish.
+//
+// GPU culling is off, so that both ways draw the same copies and
+// Mtris/s counts triangles actually drawn.  The grid is framed to fit
+// the view, so frustum culling on the CPU leaves them all.
+
+
+#include "headers.h"
+#include "instanceBench.h"
+#include "glContext.h"
+#include "renderer.h"
+#include "shader.h"
+
+#include <chrono>
+
+
+static int   frameWidth  = 600;
+static int   frameHeight = 450;
+static int   maxInstances = 100000;
+static int   maxSeparate  = 10000;
+static float minSeconds   = 1.0;
+
+
+// Render the field until minSeconds have passed.  Returns the time
+// per frame in ms.
+
+static double timeFrames( Renderer *renderer, wfModel *obj, float radius )
+
+{
+  const float initEyeDistance = 5.0;
+
+  vec3 eyePosition = (initEyeDistance * radius) * vec3(0,0,1);
+  float fovy = 2 * atan2( 1, initEyeDistance );
+
+  vec3 lightDir(1,1,0.2);
+  lightDir = lightDir.normalize();
+
+  mat4 M, MV, MVP;
+
+  // One frame to warm up
+
+  modelTransforms( obj, 0, false, eyePosition, fovy, frameWidth / (float) frameHeight, M, MV, MVP, radius );
+  renderer->render( obj, M, MV, MVP, lightDir );
+  glFinish();
+
+  int frames = 0;
+  double seconds = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  while (seconds < minSeconds || frames < 3) {
+
+    modelTransforms( obj, 0.01 * frames, false, eyePosition, fovy, frameWidth / (float) frameHeight, M, MV, MVP, radius );
+    renderer->render( obj, M, MV, MVP, lightDir );
+    frames++;
+
+    if (frames % 4 == 0 || seconds + 0.1 >= minSeconds)
+      glFinish();
+
+    seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+  }
+
+  glFinish();
+  seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+  return 1000 * seconds / frames;
+}
+
+
+int runInstanceBench( int argc, char **argv )
+
+{
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " -instbench model.obj [-size WxH] [-max n] [-maxseparate n] [-seconds s]" << endl;
+    return 1;
+  }
+
+  for (int i=3; i<argc; i++)
+    if (strcmp( argv[i], "-size" ) == 0 && i+1 < argc)
+      sscanf( argv[++i], "%dx%d", &frameWidth, &frameHeight );
+    else if (strcmp( argv[i], "-max" ) == 0 && i+1 < argc)
+      maxInstances = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-maxseparate" ) == 0 && i+1 < argc)
+      maxSeparate = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-seconds" ) == 0 && i+1 < argc)
+      minSeconds = atof( argv[++i] );
+    else {
+      cerr << "runInstanceBench: unknown option '" << argv[i] << "'" << endl;
+      return 1;
+    }
+
+  if (maxInstances < 1) {
+    cerr << "runInstanceBench: -max must be at least 1" << endl;
+    return 1;
+  }
+
+  GLContext context;
+
+  if (!context.create() || !context.makeCurrent()) {
+    cerr << "runInstanceBench: no OpenGL context" << endl;
+    return 1;
+  }
+
+  // Draw into a framebuffer object, as there is no window
+
+  GLuint fbo, colourBuffer;
+
+  glGenRenderbuffers( 1, &colourBuffer );
+  glBindRenderbuffer( GL_RENDERBUFFER, colourBuffer );
+  glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, frameWidth, frameHeight );
+
+  glGenFramebuffers( 1, &fbo );
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, fbo );
+  glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colourBuffer );
+  GLState::bindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+  Renderer *renderer = new Renderer( frameWidth, frameHeight );
+  renderer->setOutputFramebuffer( fbo );
+  renderer->gpuCulling = false;
+
+  GLState::viewport( 0, 0, frameWidth, frameHeight );
+  glClearColor( 1.0, 1.0, 1.0, 0.0 );
+
+  wfModel *obj = new wfModel( argv[2] );
+
+  int triangles = obj->numTriangles();
+
+  printf( "%s: %d triangles, %dx%d\n\n", argv[2], triangles, frameWidth, frameHeight );
+  printf( "%10s  %12s %14s %12s  %12s %14s  %8s\n",
+	  "copies", "instanced ms", "copies/s", "Mtris/s", "separate ms", "copies/s", "speedup" );
+
+  mat4 *transforms = new mat4[ maxInstances ];
+
+  for (int n=1; ; n = (n*10 > maxInstances && n < maxInstances ? maxInstances : n*10)) {
+
+    float radius = instanceGrid( obj, n, transforms );
+    obj->setInstances( n, transforms );
+
+    renderer->separateInstances = false;
+    double instancedMs = timeFrames( renderer, obj, radius );
+
+    printf( "%10d  %12.3f %14.0f %12.1f", n, instancedMs,
+	    n * 1000 / instancedMs, (double) n * triangles / instancedMs / 1000 );
+
+    if (n <= maxSeparate) {
+      renderer->separateInstances = true;
+      double separateMs = timeFrames( renderer, obj, radius );
+      printf( "  %12.3f %14.0f  %7.1fx", separateMs, n * 1000 / separateMs, separateMs / instancedMs );
+    }
+
+    printf( "\n" );
+    fflush( stdout );
+
+    if (n >= maxInstances)
+      break;
+  }
+
+  delete [] transforms;
+  delete obj;
+  delete renderer;
+  glDeleteFramebuffers( 1, &fbo );
+  glDeleteRenderbuffers( 1, &colourBuffer );
+
+  return 0;
+}
@@ -0,0 +1,12 @@
+/* instanceBench.h
+ *
+ * Measure how fast fields of many copies of a model render, with
+ * instancing and with one draw call per copy.
+ */
+
+#ifndef INSTANCEBENCH_H
+#define INSTANCEBENCH_H
+
+int runInstanceBench( int argc, char **argv );
+
+#endif
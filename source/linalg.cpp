@@ -422,6 +422,55 @@ mat4 ortho( float l, float r, float b, float t, float n, float f )
     
 
 
+// A point p is inside the view volume if -w <= x,y,z <= w for
+// (x,y,z,w) = MVP p.  Each of those six inequalities is a plane
+// made from the rows of MVP.
+
+void frustumPlanes( mat4 const& MVP, vec4 planes[6] )
+
+{
+  for (int i=0; i<3; i++) {
+    planes[2*i]   = MVP[3] + MVP[i];
+    planes[2*i+1] = MVP[3] - MVP[i];
+  }
+
+  for (int i=0; i<6; i++) {
+    float len = sqrt( planes[i].x*planes[i].x + planes[i].y*planes[i].y + planes[i].z*planes[i].z );
+    planes[i] = planes[i] / len;
+  }
+}
+
+
+bool sphereOutsideFrustum( vec4 planes[6], vec3 const& centre, float radius )
+
+{
+  for (int i=0; i<6; i++)
+    if (planes[i].x * centre.x + planes[i].y * centre.y + planes[i].z * centre.z + planes[i].w < -radius)
+      return true;
+
+  return false;
+}
+
+
+// The box is outside if, for some plane, even its corner farthest in
+// the direction of the plane's normal is outside
+
+bool boxOutsideFrustum( vec4 planes[6], vec3 const& min, vec3 const& max )
+
+{
+  for (int i=0; i<6; i++) {
+    vec4 &p = planes[i];
+    float x = (p.x > 0 ? max.x : min.x);
+    float y = (p.y > 0 ? max.y : min.y);
+    float z = (p.z > 0 ? max.z : min.z);
+    if (p.x * x + p.y * y + p.z * z + p.w < 0)
+      return true;
+  }
+
+  return false;
+}
+
+
 // I/O operators
 
 std::ostream& operator << ( std::ostream& stream, mat4 const& m )
@@ -237,6 +237,14 @@ mat4 frustum( float l, float r, float b, float t, float n, float f );
 mat4 ortho( float l, float r, float b, float t, float n, float f );
 mat4 perspective( float fovy, float aspect, float n, float f );
 
+// View volume tests.  frustumPlanes() finds the six planes (a,b,c,d)
+// bounding the view volume of MVP, in the coordinates that MVP
+// transforms from, with (a,b,c) a unit normal pointing inwards.
+
+void frustumPlanes( mat4 const& MVP, vec4 planes[6] );
+bool sphereOutsideFrustum( vec4 planes[6], vec3 const& centre, float radius );
+bool boxOutsideFrustum( vec4 planes[6], vec3 const& min, vec3 const& max );
+
 // I/O operators
 
 std::ostream& operator << ( std::ostream& stream, mat4 const& m );
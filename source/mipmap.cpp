@@ -0,0 +1,163 @@
+// Gamma-correct mipmaps
+
+
+#include "mipmap.h"
+#include "profiler.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+// sRGB <-> linear.  Linear values are looked up in LINEAR_STEPS steps,
+// which is fine enough that no two dark sRGB values share one.
+
+enum { LINEAR_STEPS = 16384 };
+
+
+class GammaTables {
+ public:
+  float   toLinear[256];
+  GLubyte toSRGB[LINEAR_STEPS];
+
+  GammaTables() {
+    for (int i=0; i<256; i++) {
+      float c = i / 255.0f;
+      toLinear[i] = (c <= 0.04045f ? c / 12.92f : powf( (c + 0.055f) / 1.055f, 2.4f ));
+    }
+    for (int i=0; i<LINEAR_STEPS; i++) {
+      float l = i / (float) (LINEAR_STEPS-1);
+      float c = (l <= 0.0031308f ? 12.92f * l : 1.055f * powf( l, 1/2.4f ) - 0.055f);
+      toSRGB[i] = (GLubyte) (c * 255 + 0.5f);
+    }
+  }
+};
+
+
+static const GammaTables &gammaTables()
+
+{
+  static GammaTables tables;	// made by the first thread to get here
+  return tables;
+}
+
+
+int numMipLevels( int width, int height )
+
+{
+  int size = (width > height ? width : height);
+  int levels = 1;
+
+  while (size > 1) {
+    size /= 2;
+    levels++;
+  }
+
+  return levels;
+}
+
+
+int mipLevelSize( int size, int level )
+
+{
+  size >>= level;
+  return (size < 1 ? 1 : size);
+}
+
+
+// One row in linear light, four floats per texel (alpha 0 if there
+// is none)
+
+static void rowToLinear( const GLubyte *row, int width, int channels, float *out, const GammaTables &g )
+
+{
+  for (int x=0; x<width; x++, row += channels, out += 4) {
+    out[0] = g.toLinear[ row[0] ];
+    out[1] = g.toLinear[ row[1] ];
+    out[2] = g.toLinear[ row[2] ];
+    out[3] = (channels == 4 ? row[3] * (1/255.0f) : 0);
+  }
+}
+
+
+// One row of the next level from two linear rows, a and b.  An odd
+// last column or row is repeated.
+
+static void averageRows( const float *a, const float *b, int srcWidth, int channels,
+			 GLubyte *dest, int destWidth, const GammaTables &g )
+
+{
+  float avg[4];
+
+#ifdef __SSE2__
+  __m128 quarter = _mm_set1_ps( 0.25f );
+#endif
+
+  for (int x=0; x<destWidth; x++, dest += channels) {
+
+    int x0 = 2*x;
+    int x1 = (x0+1 < srcWidth ? x0+1 : x0);
+
+#ifdef __SSE2__
+    __m128 s = _mm_add_ps( _mm_add_ps( _mm_loadu_ps( a + 4*x0 ), _mm_loadu_ps( a + 4*x1 ) ),
+			   _mm_add_ps( _mm_loadu_ps( b + 4*x0 ), _mm_loadu_ps( b + 4*x1 ) ) );
+    _mm_storeu_ps( avg, _mm_mul_ps( s, quarter ) );
+#else
+    for (int c=0; c<4; c++)
+      avg[c] = 0.25f * (a[4*x0+c] + a[4*x1+c] + b[4*x0+c] + b[4*x1+c]);
+#endif
+
+    for (int c=0; c<3; c++)
+      dest[c] = g.toSRGB[ (int) (avg[c] * (LINEAR_STEPS-1) + 0.5f) ];
+
+    if (channels == 4)
+      dest[3] = (GLubyte) (avg[3] * 255 + 0.5f);
+  }
+}
+
+
+void halveImage( const GLubyte *src, int width, int height, int channels, GLubyte *dest, ThreadPool *pool )
+
+{
+  PROFILE_ZONE( "halveImage" );
+
+  const GammaTables &g = gammaTables();
+
+  int destWidth  = mipLevelSize( width, 1 );
+  int destHeight = mipLevelSize( height, 1 );
+
+  const int bandRows = 16;
+  int numBands = (destHeight + bandRows-1) / bandRows;
+
+  auto band = [&]( int b ) {
+
+    float *rowA = new float[ 4 * width ];
+    float *rowB = new float[ 4 * width ];
+
+    int yEnd = (b+1) * bandRows;
+    if (yEnd > destHeight)
+      yEnd = destHeight;
+
+    for (int y=b*bandRows; y<yEnd; y++) {
+
+      int y0 = 2*y;
+      int y1 = (y0+1 < height ? y0+1 : y0);
+
+      rowToLinear( src + (long) y0 * width * channels, width, channels, rowA, g );
+      rowToLinear( src + (long) y1 * width * channels, width, channels, rowB, g );
+
+      averageRows( rowA, rowB, width, channels, dest + (long) y * destWidth * channels, destWidth, g );
+    }
+
+    delete [] rowA;
+    delete [] rowB;
+  };
+
+  if (pool != NULL)
+    pool->parallelFor( numBands, band );
+  else
+    for (int b=0; b<numBands; b++)
+      band( b );
+}
@@ -0,0 +1,32 @@
+/* mipmap.h
+ *
+ * Mipmaps of 8-bit sRGB images, made on the CPU.  Each level halves
+ * the one above it (rounding down, to no less than 1) and each texel
+ * is the average of a 2x2 box of the level above.  Colours are
+ * averaged in linear light, so that fine detail doesn't darken as it
+ * shrinks; alpha is averaged as it is.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     numMipLevels( width, height )   Levels down to 1x1, including the
+ *                                     image itself
+ *     mipLevelSize( size, level )     Width or height of a level
+ *     halveImage( src, width, height, channels, dest, pool )
+ *                                     Make the next level of src in dest,
+ *                                     in bands of rows on pool (which
+ *                                     may be NULL)
+ */
+
+
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "headers.h"
+#include "threadPool.h"
+
+
+int  numMipLevels( int width, int height );
+int  mipLevelSize( int size, int level );
+void halveImage( const GLubyte *src, int width, int height, int channels, GLubyte *dest, ThreadPool *pool );
+
+#endif
@@ -0,0 +1,148 @@
+// Background model loading
+
+
+#include "modelLoader.h"
+#include "profiler.h"
+
+
+ModelLoader::ModelLoader()
+  : loaded( 1 ), numPending( 0 )
+
+{
+  request = NULL;
+  closing = false;
+
+  thread = new std::thread( &ModelLoader::loaderMain, this );
+}
+
+
+// Models that were loaded but never taken have no OpenGL objects, so
+// they can be deleted here
+
+ModelLoader::~ModelLoader()
+
+{
+  {
+    std::lock_guard<std::mutex> guard( lock );
+    closing = true;
+    requested.notify_all();
+  }
+
+  loaded.close();
+
+  thread->join();
+  delete thread;
+
+  free( request );
+
+  Loaded item;
+  while (loaded.tryPop( item )) {
+    delete item.model;
+    free( item.filename );
+  }
+}
+
+
+// Wait for a request and take it.  Returns NULL once the loader is
+// being deleted.
+
+char *ModelLoader::nextRequest()
+
+{
+  std::unique_lock<std::mutex> guard( lock );
+
+  while (!closing && request == NULL)
+    requested.wait( guard );
+
+  if (closing)
+    return NULL;
+
+  char *filename = request;
+  request = NULL;
+
+  return filename;
+}
+
+
+// A model loaded while a newer one was requested won't be shown
+
+bool ModelLoader::overtaken()
+
+{
+  std::lock_guard<std::mutex> guard( lock );
+
+  return request != NULL;
+}
+
+
+void ModelLoader::loaderMain()
+
+{
+  Profiler::setThreadName( "model loader" );
+
+  char *filename;
+
+  while ((filename = nextRequest()) != NULL) {
+
+    Loaded item;
+
+    item.filename = filename;
+    item.model = new wfModel();
+
+    {
+      PROFILE_ZONE( "ModelLoader load" );
+      item.model->read( filename );
+      item.model->buildBuffers();
+    }
+
+    if (overtaken()) {
+      delete item.model;
+      free( filename );
+      numPending--;
+      continue;
+    }
+
+    if (!loaded.push( item )) { // closed: the loader is being deleted
+      delete item.model;
+      free( filename );
+      return;
+    }
+  }
+}
+
+
+// Never waits, so the render thread can call it at any time
+
+void ModelLoader::load( const char *filename )
+
+{
+  std::lock_guard<std::mutex> guard( lock );
+
+  if (closing)
+    return;
+
+  if (request != NULL)
+    free( request );		// replaced before it started
+  else
+    numPending++;
+
+  request = strdup( filename );
+  requested.notify_one();
+}
+
+
+bool ModelLoader::take( wfModel *&model, char *&filename )
+
+{
+  Loaded item;
+
+  if (!loaded.tryPop( item ))
+    return false;
+
+  numPending--;
+
+  model = item.model;
+  filename = item.filename;
+
+  return true;
+}
@@ -0,0 +1,78 @@
+/* modelLoader.h
+ *
+ * Loads models on a background thread, so that the window stays live
+ * while they load.  The thread reads each model and builds its vertex,
+ * index and draw buffers (wfModel::read() and buildBuffers(), which
+ * need no OpenGL).  The render thread takes each loaded model and
+ * finishes it with setupVAO() in its own context.
+ *
+ * Only the newest request is kept: load() never waits, and a request
+ * replaces one that hasn't started loading.  A model whose loading was
+ * overtaken by a newer request is dropped rather than shown.  A loaded
+ * model waits to be taken before the next one is loaded, so a request
+ * can be made while the current model is still being shown.
+ *
+ *   CONSTRUCTORS
+ *
+ *     ModelLoader()              Start the loader thread
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     load( filename )           Request a model, replacing any request
+ *                                that hasn't started
+ *     take( model, filename )    Get a loaded model and its filename
+ *                                (free() it), or return false if none
+ *                                is ready.  The caller owns the model
+ *                                and must call setupVAO() on it.
+ *     pending()                  Models requested, loading, or not yet
+ *                                taken
+ */
+
+
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include "wavefront.h"
+#include "syncQueue.h"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+class ModelLoader {
+
+  class Loaded {
+  public:
+    char    *filename;
+    wfModel *model;
+  };
+
+  std::mutex              lock;
+  std::condition_variable requested;
+  char                   *request;	// newest unstarted request, or NULL
+  bool                    closing;
+
+  syncQueue<Loaded>       loaded;
+  std::thread            *thread;
+  std::atomic<int>        numPending;
+
+  char *nextRequest();
+  bool  overtaken();
+  void  loaderMain();
+
+ public:
+
+  ModelLoader();
+  ~ModelLoader();
+
+  void load( const char *filename );
+  bool take( wfModel *&model, char *&filename );
+
+  int pending() {
+    return numPending;
+  }
+};
+
+#endif
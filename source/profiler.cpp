@@ -0,0 +1,170 @@
+// CPU profiler with Chrome trace output
+
+
+#include "profiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <chrono>
+using namespace std;
+
+
+std::atomic<bool> Profiler::recording( false );
+
+static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+// All threads' rings, newest first.  A ring outlives its thread so
+// that the zones of finished threads (e.g. loaders) are in the trace.
+
+static std::atomic<Profiler::ThreadRing*> rings( NULL );
+static std::mutex                         ringsLock;
+static int                                nextTid = 1;
+
+static thread_local Profiler::ThreadRing *myRing = NULL;
+static thread_local const char           *myName = NULL;
+
+
+long long Profiler::now()
+
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - epoch ).count();
+}
+
+
+void Profiler::start()
+
+{
+  recording.store( true );
+}
+
+
+void Profiler::stop()
+
+{
+  recording.store( false );
+}
+
+
+// The calling thread's ring, created on its first zone
+
+Profiler::ThreadRing *Profiler::threadRing()
+
+{
+  if (myRing == NULL) {
+
+    ThreadRing *ring = new ThreadRing;
+    ring->count.store( 0 );
+    ring->name = myName;
+
+    std::lock_guard<std::mutex> guard( ringsLock );
+
+    ring->tid = nextTid++;
+    ring->next = rings.load();
+    rings.store( ring );
+
+    myRing = ring;
+  }
+
+  return myRing;
+}
+
+
+void Profiler::setThreadName( const char *name )
+
+{
+  myName = name;
+  if (myRing != NULL)
+    myRing->name = name;
+}
+
+
+void Profiler::record( const char *name, long long start, long long end )
+
+{
+  ThreadRing *ring = threadRing();
+
+  unsigned n = ring->count.load( std::memory_order_relaxed );
+
+  Zone &z = ring->zones[ n % RING_SIZE ];
+  z.name = name;
+  z.start = start;
+  z.end = end;
+
+  ring->count.store( n+1, std::memory_order_release );
+}
+
+
+// Write a zone name as a JSON string
+
+static void writeName( FILE *file, const char *s )
+
+{
+  fputc( '"', file );
+  for (; *s != '\0'; s++)
+    if (*s == '"' || *s == '\\')
+      fprintf( file, "\\%c", *s );
+    else if ((unsigned char) *s >= ' ')
+      fputc( *s, file );
+  fputc( '"', file );
+}
+
+
+// Write all rings.  Other threads may go on recording while this
+// runs; zones that they might have overwritten meanwhile are left out.
+
+bool Profiler::writeTrace( const char *filename )
+
+{
+  FILE *file = fopen( filename, "w" );
+  if (file == NULL) {
+    cerr << "Profiler: can't write '" << filename << "'" << endl;
+    return false;
+  }
+
+  fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+  bool first = true;
+  int numZones = 0;
+
+  for (ThreadRing *ring = rings.load(); ring != NULL; ring = ring->next) {
+
+    if (ring->name != NULL) {
+      fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+	       (first ? "" : ",\n"), ring->tid );
+      writeName( file, ring->name );
+      fprintf( file, "}}" );
+      first = false;
+    }
+
+    unsigned end = ring->count.load( std::memory_order_acquire );
+    unsigned begin = (end > RING_SIZE ? end - RING_SIZE : 0);
+
+    for (unsigned i=begin; i<end; i++) {
+
+      Zone z = ring->zones[ i % RING_SIZE ];
+
+      // Overwritten (or being overwritten) while it was copied?
+
+      std::atomic_thread_fence( std::memory_order_acquire );
+      unsigned latest = ring->count.load( std::memory_order_relaxed );
+      if (latest - i >= RING_SIZE)
+	continue;
+
+      fprintf( file, "%s{\"name\":", (first ? "" : ",\n") );
+      writeName( file, z.name );
+      fprintf( file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+	       ring->tid, z.start / 1000.0, (z.end - z.start) / 1000.0 );
+      first = false;
+      numZones++;
+    }
+  }
+
+  fprintf( file, "\n]}\n" );
+  fclose( file );
+
+  cerr << "Wrote " << numZones << " profile zones to '" << filename << "'" << endl;
+
+  return true;
+}
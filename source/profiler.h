@@ -0,0 +1,105 @@
+/* profiler.h
+ *
+ * A CPU profiler for scoped zones, with output in the Chrome trace
+ * format (load it in chrome://tracing or ui.perfetto.dev).
+ *
+ *   PROFILE_ZONE( "name" );    Time from here to the end of the scope
+ *
+ * Each thread records its zones in its own ring buffer of the last
+ * RING_SIZE zones, so recording takes no locks.  When the profiler
+ * is off, a zone costs one test of a flag.  Compiling with
+ * -DNO_PROFILER removes the zones altogether.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     Profiler::start()               Start recording
+ *     Profiler::stop()                Stop recording
+ *     Profiler::isRecording()
+ *     Profiler::setThreadName( s )    Name the calling thread in the trace
+ *     Profiler::writeTrace( file )    Write the recorded zones of all
+ *                                     threads as Chrome trace JSON
+ *
+ * Zone names must be string constants, since only the pointer is kept.
+ */
+
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+
+
+class Profiler {
+
+ public:
+
+  enum { RING_SIZE = 1 << 16 };
+
+  class Zone {
+  public:
+    const char *name;
+    long long   start, end;	// ns since the profiler's epoch
+  };
+
+  class ThreadRing {
+  public:
+    Zone                    zones[ RING_SIZE ];
+    std::atomic<unsigned>   count;	// zones ever recorded; only the owner writes it
+    int                     tid;
+    const char             *name;
+    ThreadRing             *next;
+  };
+
+  static std::atomic<bool> recording;
+
+  static void start();
+  static void stop();
+  static bool isRecording() {
+    return recording.load( std::memory_order_relaxed );
+  }
+
+  static void setThreadName( const char *name );
+  static bool writeTrace( const char *filename );
+
+  static long long now();
+  static void record( const char *name, long long start, long long end );
+
+ private:
+
+  static ThreadRing *threadRing();
+};
+
+
+// Records a zone from its construction to its destruction
+
+class ProfileZone {
+
+  const char *name;
+  long long   start;
+
+ public:
+
+  ProfileZone( const char *zoneName ) {
+    if (Profiler::isRecording()) {
+      name = zoneName;
+      start = Profiler::now();
+    } else
+      start = -1;
+  }
+
+  ~ProfileZone() {
+    if (start >= 0)
+      Profiler::record( name, start, Profiler::now() );
+  }
+};
+
+
+#ifdef NO_PROFILER
+#define PROFILE_ZONE( name )
+#else
+#define PROFILE_ZONE_NAME2( line ) profileZone ## line
+#define PROFILE_ZONE_NAME( line ) PROFILE_ZONE_NAME2( line )
+#define PROFILE_ZONE( name ) ProfileZone PROFILE_ZONE_NAME( __LINE__ )( name )
+#endif
+
+#endif
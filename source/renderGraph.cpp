@@ -0,0 +1,520 @@
+// Render passes and their transient textures
+
+
+#include "renderGraph.h"
+#include "profiler.h"
+
+
+RenderGraph::RenderGraph( GPUTimer *gpuTimer )
+
+{
+  timer = gpuTimer;
+  glGenFramebuffers( 1, &readFBO );
+}
+
+
+RenderGraph::~RenderGraph()
+
+{
+  for (unsigned int i=0; i<framebuffers.size(); i++)
+    glDeleteFramebuffers( 1, &framebuffers[i].fbo );
+
+  for (unsigned int i=0; i<physicals.size(); i++)
+    glDeleteTextures( 1, &physicals[i].texture );
+
+  glDeleteFramebuffers( 1, &readFBO );
+
+  GLState::forget();
+}
+
+
+void RenderGraph::beginFrame()
+
+{
+  textures.clear();
+  passes.clear();
+}
+
+
+int RenderGraph::createTexture( const char *name, int width, int height, GLenum format )
+
+{
+  Texture tex;
+
+  tex.name = name;
+  tex.width = width;
+  tex.height = height;
+  tex.format = format;
+  tex.writer = -1;
+  tex.lastUse = -1;
+  tex.physical = -1;
+
+  textures.push_back( tex );
+
+  return textures.size() - 1;
+}
+
+
+int RenderGraph::addPass( const char *name, int timerPass, std::function<void()> body )
+
+{
+  Pass pass;
+
+  pass.name = name;
+  pass.timerPass = timerPass;
+  pass.body = body;
+  pass.numWrites = 0;
+  pass.numReads = 0;
+  pass.depthStencil = -1;
+  pass.clearMask = 0;
+  pass.external = false;
+  pass.outputFBO = 0;
+  pass.outputWidth = pass.outputHeight = 0;
+  pass.kept = false;
+  pass.live = false;
+
+  passes.push_back( pass );
+
+  return passes.size() - 1;
+}
+
+
+void RenderGraph::write( int pass, int tex )
+
+{
+  Pass &p = passes[pass];
+
+  if (textures[tex].writer >= 0) {
+    cerr << "RenderGraph: '" << textures[tex].name << "' is written by both '"
+	 << passes[ textures[tex].writer ].name << "' and '" << p.name << "'" << endl;
+    return;
+  }
+
+  if (p.numWrites == MAX_ATTACHMENTS) {
+    cerr << "RenderGraph: '" << p.name << "' writes too many textures" << endl;
+    return;
+  }
+
+  p.writes[ p.numWrites++ ] = tex;
+  textures[tex].writer = pass;
+}
+
+
+void RenderGraph::read( int pass, int tex, int unit )
+
+{
+  Pass &p = passes[pass];
+
+  if (p.numReads == MAX_READS) {
+    cerr << "RenderGraph: '" << p.name << "' reads too many textures" << endl;
+    return;
+  }
+
+  p.reads[ p.numReads ] = tex;
+  p.readUnits[ p.numReads ] = unit;
+  p.numReads++;
+}
+
+
+// A depth/stencil texture that the pass only tests against counts as
+// a read
+
+void RenderGraph::useDepthStencil( int pass, int tex, bool write )
+
+{
+  Pass &p = passes[pass];
+
+  p.depthStencil = tex;
+
+  if (write) {
+    if (textures[tex].writer >= 0)
+      cerr << "RenderGraph: '" << textures[tex].name << "' is written by both '"
+	   << passes[ textures[tex].writer ].name << "' and '" << p.name << "'" << endl;
+    else
+      textures[tex].writer = pass;
+  }
+}
+
+
+void RenderGraph::clear( int pass, GLbitfield mask )
+
+{
+  passes[pass].clearMask = mask;
+}
+
+
+void RenderGraph::output( int pass, GLuint fbo, int width, int height )
+
+{
+  Pass &p = passes[pass];
+
+  p.external = true;
+  p.outputFBO = fbo;
+  p.outputWidth = width;
+  p.outputHeight = height;
+}
+
+
+void RenderGraph::keep( int pass )
+
+{
+  passes[pass].kept = true;
+}
+
+
+// A pass is live if it is the target, is kept, or writes something
+// that a live pass uses.  Writers come before their readers, so one
+// sweep from the end finds them all.
+
+void RenderGraph::findLivePasses( int target )
+
+{
+  for (unsigned int p=0; p<passes.size(); p++)
+    passes[p].live = (p == (unsigned int) target || passes[p].kept);
+
+  for (int p=passes.size()-1; p>=0; p--) {
+
+    Pass &pass = passes[p];
+
+    if (!pass.live)
+      continue;
+
+    for (int i=0; i<pass.numReads; i++) {
+      int w = textures[ pass.reads[i] ].writer;
+      if (w >= 0)
+	passes[w].live = true;
+    }
+
+    if (pass.depthStencil >= 0) {
+      int w = textures[ pass.depthStencil ].writer;
+      if (w >= 0)
+	passes[w].live = true;
+    }
+  }
+}
+
+
+// Give each texture that a live pass writes a physical texture from
+// its writer to its last use.  Physical textures are handed out in
+// pass order, so the same graph gets the same ones every frame and
+// their framebuffers are reused.
+
+void RenderGraph::allocateTextures()
+
+{
+  for (unsigned int t=0; t<textures.size(); t++) {
+    Texture &tex = textures[t];
+    tex.physical = -1;
+    tex.lastUse = (tex.writer >= 0 && passes[ tex.writer ].live ? tex.writer : -1);
+  }
+
+  for (unsigned int p=0; p<passes.size(); p++) {
+
+    Pass &pass = passes[p];
+
+    if (!pass.live)
+      continue;
+
+    for (int i=0; i<pass.numReads; i++)
+      textures[ pass.reads[i] ].lastUse = p;
+
+    if (pass.depthStencil >= 0)
+      textures[ pass.depthStencil ].lastUse = p;
+  }
+
+  for (unsigned int i=0; i<physicals.size(); i++) {
+    physicals[i].busyUntil = -1;
+    physicals[i].used = false;
+  }
+
+  for (unsigned int p=0; p<passes.size(); p++) {
+
+    Pass &pass = passes[p];
+
+    if (!pass.live)
+      continue;
+
+    for (int i=0; i<pass.numWrites; i++) {
+      Texture &tex = textures[ pass.writes[i] ];
+      tex.physical = acquire( tex, p );
+    }
+
+    if (pass.depthStencil >= 0 && textures[ pass.depthStencil ].writer == (int) p) {
+      Texture &tex = textures[ pass.depthStencil ];
+      tex.physical = acquire( tex, p );
+    }
+  }
+
+  for (unsigned int t=0; t<textures.size(); t++)
+    if (textures[t].lastUse >= 0 && textures[t].physical < 0)
+      cerr << "RenderGraph: '" << textures[t].name << "' is read but never written" << endl;
+}
+
+
+// A physical texture for tex that is free at 'pass', or a new one
+
+int RenderGraph::acquire( Texture &tex, int pass )
+
+{
+  for (unsigned int i=0; i<physicals.size(); i++) {
+
+    Physical &phys = physicals[i];
+
+    if (phys.busyUntil < pass && phys.width == tex.width && phys.height == tex.height && phys.format == tex.format) {
+      phys.busyUntil = tex.lastUse;
+      phys.used = true;
+      return i;
+    }
+  }
+
+  Physical phys;
+
+  phys.width = tex.width;
+  phys.height = tex.height;
+  phys.format = tex.format;
+  phys.busyUntil = tex.lastUse;
+  phys.used = true;
+
+  glGenTextures( 1, &phys.texture );
+  GLState::bindTexture( 0, phys.texture );
+
+  if (tex.format == GL_DEPTH32F_STENCIL8)
+    glTexImage2D( GL_TEXTURE_2D, 0, tex.format, tex.width, tex.height, 0, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, NULL );
+  else
+    glTexImage2D( GL_TEXTURE_2D, 0, tex.format, tex.width, tex.height, 0, GL_RGB, GL_FLOAT, NULL );
+
+  // Neighbourhood lookups at the border read the border texel, not
+  // the opposite side.  No mipmaps, so that the texture can be read.
+
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+  physicals.push_back( phys );
+
+  return physicals.size() - 1;
+}
+
+
+// Delete the physical textures that this frame didn't use, e.g. after
+// a change of window size, and the framebuffers that they were in
+
+void RenderGraph::releaseUnused()
+
+{
+  bool deleted = false;
+
+  for (int i=physicals.size()-1; i>=0; i--) {
+
+    if (physicals[i].used)
+      continue;
+
+    GLuint t = physicals[i].texture;
+
+    for (int f=framebuffers.size()-1; f>=0; f--) {
+
+      Framebuffer &fb = framebuffers[f];
+      bool uses = (fb.depthStencil == t);
+
+      for (int c=0; c<fb.numColour; c++)
+	if (fb.colour[c] == t)
+	  uses = true;
+
+      if (uses) {
+	glDeleteFramebuffers( 1, &fb.fbo );
+	framebuffers.erase( framebuffers.begin() + f );
+      }
+    }
+
+    glDeleteTextures( 1, &t );
+    physicals.erase( physicals.begin() + i );
+    deleted = true;
+  }
+
+  // Deleting a bound texture or framebuffer unbinds it
+
+  if (deleted)
+    GLState::forget();
+}
+
+
+// The framebuffer with the pass's attachments, made the first time
+// they are used together
+
+GLuint RenderGraph::framebufferFor( Pass &pass )
+
+{
+  Framebuffer key;
+
+  key.numColour = pass.numWrites;
+  for (int i=0; i<pass.numWrites; i++)
+    key.colour[i] = texture( pass.writes[i] );
+  key.depthStencil = (pass.depthStencil >= 0 ? texture( pass.depthStencil ) : 0);
+
+  for (unsigned int f=0; f<framebuffers.size(); f++) {
+
+    Framebuffer &fb = framebuffers[f];
+
+    if (fb.numColour != key.numColour || fb.depthStencil != key.depthStencil)
+      continue;
+
+    bool same = true;
+    for (int i=0; i<fb.numColour; i++)
+      if (fb.colour[i] != key.colour[i])
+	same = false;
+
+    if (same)
+      return fb.fbo;
+  }
+
+  glGenFramebuffers( 1, &key.fbo );
+  GLState::bindFramebuffer( GL_DRAW_FRAMEBUFFER, key.fbo );
+
+  GLenum drawBuffers[ MAX_ATTACHMENTS ];
+
+  for (int i=0; i<key.numColour; i++) {
+    glFramebufferTexture2D( GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, key.colour[i], 0 );
+    drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+  }
+
+  if (key.depthStencil != 0)
+    glFramebufferTexture2D( GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, key.depthStencil, 0 );
+
+  if (key.numColour > 0)
+    glDrawBuffers( key.numColour, drawBuffers );
+  else
+    glDrawBuffer( GL_NONE );
+
+  GLenum status = glCheckFramebufferStatus( GL_DRAW_FRAMEBUFFER );
+
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    cerr << "RenderGraph: framebuffer for '" << pass.name << "' is incomplete (status 0x"
+	 << std::hex << status << std::dec << ")" << endl;
+
+  framebuffers.push_back( key );
+
+  return key.fbo;
+}
+
+
+// Bind the pass's framebuffer and set the viewport to its size.  A
+// pass with no attachments (e.g. compute) leaves them alone.
+
+void RenderGraph::bindTargets( Pass &pass )
+
+{
+  GLuint fbo;
+  int    width, height;
+
+  if (pass.external) {
+    fbo = pass.outputFBO;
+    width = pass.outputWidth;
+    height = pass.outputHeight;
+  } else if (pass.numWrites > 0 || pass.depthStencil >= 0) {
+    Texture &tex = textures[ pass.numWrites > 0 ? pass.writes[0] : pass.depthStencil ];
+    fbo = framebufferFor( pass );
+    width = tex.width;
+    height = tex.height;
+  } else
+    return;
+
+  GLState::bindFramebuffer( GL_DRAW_FRAMEBUFFER, fbo );
+  GLState::viewport( 0, 0, width, height );
+}
+
+
+void RenderGraph::execute( int target )
+
+{
+  PROFILE_ZONE( "RenderGraph::execute" );
+
+  findLivePasses( target );
+  allocateTextures();
+
+  int timing = -1;		// timer pass that is running
+
+  for (unsigned int p=0; p<passes.size(); p++) {
+
+    Pass &pass = passes[p];
+
+    if (!pass.live)
+      continue;
+
+    if (pass.timerPass != timing && timer != NULL) {
+      if (timing >= 0)
+	timer->endPass( timing );
+      if (pass.timerPass >= 0)
+	timer->beginPass( pass.timerPass );
+    }
+    timing = pass.timerPass;
+
+    PROFILE_ZONE( pass.name );
+
+    bindTargets( pass );
+
+    for (int i=0; i<pass.numReads; i++)
+      if (pass.readUnits[i] >= 0)
+	GLState::bindTexture( pass.readUnits[i], texture( pass.reads[i] ) );
+
+    if (pass.clearMask != 0)
+      glClear( pass.clearMask );
+
+    pass.body();
+  }
+
+  if (timing >= 0 && timer != NULL)
+    timer->endPass( timing );
+
+  releaseUnused();
+}
+
+
+GLuint RenderGraph::texture( int tex )
+
+{
+  int p = textures[tex].physical;
+
+  return (p >= 0 ? physicals[p].texture : 0);
+}
+
+
+// Copy tex into (x0,y0)-(x1,y1) of the bound draw framebuffer
+
+void RenderGraph::blit( int tex, int x0, int y0, int x1, int y1, GLenum filter )
+
+{
+  Texture &t = textures[tex];
+
+  GLState::bindFramebuffer( GL_READ_FRAMEBUFFER, readFBO );
+  glFramebufferTexture2D( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture( tex ), 0 );
+  glReadBuffer( GL_COLOR_ATTACHMENT0 );
+
+  glBlitFramebuffer( 0, 0, t.width, t.height, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT, filter );
+
+  glFramebufferTexture2D( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0 );
+}
+
+
+long RenderGraph::textureMemory()
+
+{
+  long bytes = 0;
+
+  for (unsigned int i=0; i<physicals.size(); i++) {
+
+    Physical &phys = physicals[i];
+    int texelSize;
+
+    switch (phys.format) {
+    case GL_RGB32F:             texelSize = 12; break;
+    case GL_RGBA32F:            texelSize = 16; break;
+    case GL_DEPTH32F_STENCIL8:  texelSize = 8;  break;
+    default:                    texelSize = 4;  break;
+    }
+
+    bytes += (long) phys.width * phys.height * texelSize;
+  }
+
+  return bytes;
+}
@@ -0,0 +1,151 @@
+/* renderGraph.h
+ *
+ * A frame's render passes and the textures that they hand on to each
+ * other.
+ *
+ * Each frame, the renderer declares its passes in the order they run,
+ * with the textures that each one writes and reads, and then executes
+ * the graph.  The graph
+ *
+ *   - runs only the target pass, the passes it depends on, and passes
+ *     marked with keep(),
+ *
+ *   - gives each texture a physical texture only from the pass that
+ *     writes it to the last pass that reads it, so textures whose
+ *     lifetimes don't overlap share memory, and a chain of passes
+ *     takes two textures however long it is,
+ *
+ *   - makes a framebuffer (with its draw buffers) once for each set of
+ *     attachments.
+ *
+ * A texture is written by one pass only.  A pass that would update a
+ * texture in place writes a new one instead.  Physical textures are
+ * kept from frame to frame, and deleted in a frame that doesn't use
+ * them.
+ *
+ * Pass bodies draw with whatever programs and state they need.  The
+ * framebuffer, viewport, clear and declared texture bindings are done
+ * (through GLState) before the body runs.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     beginFrame()                        Forget last frame's passes
+ *     createTexture( name, w, h, format ) A texture for this frame
+ *     addPass( name, timerPass, body )    A pass, timed as timerPass of
+ *                                         the GPUTimer (-1 = untimed)
+ *     write( pass, tex )                  The pass draws into tex, in the
+ *                                         next colour attachment
+ *     read( pass, tex, unit )             The pass samples tex on unit
+ *                                         (-1 = the body uses texture())
+ *     useDepthStencil( pass, tex, write ) Attach tex as the depth/stencil
+ *     clear( pass, mask )                 Clear the attachments first
+ *     output( pass, fbo, w, h )           Draw into an outside framebuffer
+ *     keep( pass )                        Run even if nothing reads from it
+ *     execute( target )                   Run target and what it needs
+ *
+ *     texture( tex )                      GL texture of tex, during execute()
+ *     blit( tex, x0, y0, x1, y1, filter ) Copy tex to the draw framebuffer
+ *     textureMemory()                     Bytes in physical textures
+ */
+
+
+#ifndef RENDERGRAPH_H
+#define RENDERGRAPH_H
+
+#include "headers.h"
+#include "gpuTimer.h"
+#include "glState.h"
+
+#include <functional>
+#include <vector>
+
+
+class RenderGraph {
+
+  enum { MAX_ATTACHMENTS = 4, MAX_READS = 8 };
+
+  class Texture {		// as declared this frame
+  public:
+    const char *name;
+    int    width, height;
+    GLenum format;
+    int    writer;		// pass that writes it (-1 = none yet)
+    int    lastUse;		// last live pass that uses it
+    int    physical;		// index in 'physicals' (-1 = none)
+  };
+
+  class Pass {
+  public:
+    const char *name;
+    int    timerPass;
+    std::function<void()> body;
+
+    int    writes[MAX_ATTACHMENTS], numWrites;
+    int    reads[MAX_READS], readUnits[MAX_READS], numReads;
+    int    depthStencil;	// -1 = none
+    GLbitfield clearMask;
+
+    bool   external;		// draws into outputFBO
+    GLuint outputFBO;
+    int    outputWidth, outputHeight;
+
+    bool   kept, live;
+  };
+
+  class Physical {		// GL texture, given to the textures in turn
+  public:
+    GLuint texture;
+    int    width, height;
+    GLenum format;
+    int    busyUntil;		// last pass of the texture it holds
+    bool   used;		// this frame
+  };
+
+  class Framebuffer {
+  public:
+    GLuint fbo;
+    GLuint depthStencil;
+    GLuint colour[MAX_ATTACHMENTS];
+    int    numColour;
+  };
+
+  std::vector<Texture>     textures;
+  std::vector<Pass>        passes;
+  std::vector<Physical>    physicals;
+  std::vector<Framebuffer> framebuffers;
+
+  GPUTimer *timer;
+  GLuint    readFBO;		// for blit()
+
+  void   findLivePasses( int target );
+  void   allocateTextures();
+  int    acquire( Texture &tex, int pass );
+  void   releaseUnused();
+  GLuint framebufferFor( Pass &pass );
+  void   bindTargets( Pass &pass );
+
+ public:
+
+  RenderGraph( GPUTimer *gpuTimer = NULL );
+  ~RenderGraph();
+
+  void beginFrame();
+
+  int  createTexture( const char *name, int width, int height, GLenum format = GL_RGB32F );
+  int  addPass( const char *name, int timerPass, std::function<void()> body );
+
+  void write( int pass, int tex );
+  void read( int pass, int tex, int unit );
+  void useDepthStencil( int pass, int tex, bool write );
+  void clear( int pass, GLbitfield mask );
+  void output( int pass, GLuint fbo, int width, int height );
+  void keep( int pass );
+
+  void execute( int target );
+
+  GLuint texture( int tex );
+  void   blit( int tex, int x0, int y0, int x1, int y1, GLenum filter );
+  long   textureMemory();
+};
+
+#endif
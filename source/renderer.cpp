@@ -4,6 +4,7 @@
 #include "headers.h"
 #include "renderer.h"
 #include "shader.h"
+#include "profiler.h"
 
 
 // Draw a quad over the full screen.  This generates a fragment for
@@ -36,88 +37,619 @@ void drawFullscreenQuad()
 }
 
 
-// Render the scene in three passes.
+// Stencil test for the pixels that pass 1 covered
+
+static void maskToCovered()
+
+{
+  GLState::enable( GL_STENCIL_TEST );
+  glStencilFunc( GL_EQUAL, 1, 0xFF );
+  glStencilOp( GL_KEEP, GL_KEEP, GL_KEEP );
+}
+
+
+// Render the scene in three passes.  The passes are declared to the
+// render graph, which runs those that the final image (or the debug
+// view) needs and gives their textures memory only while they are in
+// use.
 
 
 void Renderer::render( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, vec3 &lightDir )
 
 {
-  // Pass 1: Store colour, normal, depth in G-Buffers
+  PROFILE_ZONE( "Renderer::render" );
+
+  timer->beginFrame();
+  graph->beginFrame();
+  GLState::beginFrame();
+
+  edgeWidth = (width + edgeScale-1) / edgeScale;
+  edgeHeight = (height + edgeScale-1) / edgeScale;
+
+  // Pass 1: Store colour, normal, depth in G-Buffers, and mark the
+  // covered pixels with 1 in the stencil
+
+  int colour       = graph->createTexture( "colour", width, height );
+  int normal       = graph->createTexture( "normal", width, height );
+  int depth        = graph->createTexture( "depth",  width, height );
+  int depthStencil = graph->createTexture( "depth/stencil", width, height, GL_DEPTH32F_STENCIL8 );
+
+  int pass1 = graph->addPass( "pass 1", 0, [=]() mutable {
+      drawModel( obj, M, MV, MVP, graph->texture( depthStencil ) );
+    } );
+
+  graph->write( pass1, colour );
+  graph->write( pass1, normal );
+  graph->write( pass1, depth );
+  graph->useDepthStencil( pass1, depthStencil, true );
+  graph->clear( pass1, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
+
+  int debug1 = showTextures( colour, normal, depth, -1 );
+
+  // Pass 2: Store Laplacian (computed from depths).  With edgeScale >
+  // 1, this and the outline passes run at reduced size, on the
+  // nearest depth under each pixel.
+
+  int edgeDepth = (edgeScale > 1 ? downsampleDepth( depth ) : depth);
+  int laplacian = graph->createTexture( "laplacian", edgeWidth, edgeHeight );
+
+  // Only the covered pixels can be edges, as a background pixel's
+  // Laplacian is never negative.  So the others are left with the
+  // clear colour (white, which is not an edge either) and don't run
+  // the shader.  (Only the full-size stencil can mask.)  Unmasked,
+  // the shader writes every pixel and there is nothing to clear.
+
+  bool maskEdges = (maskBackground && edgeScale == 1);
+
+  int pass2 = graph->addPass( "pass 2", 1, [=]() {
+
+      pass2Prog->activate();
+
+      pass2Prog->setVec2( "texCoordInc", vec2( 1 / (float) edgeWidth, 1 / (float) edgeHeight ) );
+      pass2Prog->setInt( "depthSampler", DEPTH_UNIT );
+
+      GLState::disable( GL_DEPTH_TEST );
+
+      if (maskEdges)
+	maskToCovered();
+
+      drawFullscreenQuad();
+
+      GLState::disable( GL_STENCIL_TEST );
+
+      pass2Prog->deactivate();
+    } );
+
+  graph->read( pass2, edgeDepth, DEPTH_UNIT );
+  graph->write( pass2, laplacian );
+
+  if (maskEdges) {
+    graph->useDepthStencil( pass2, depthStencil, false );
+    graph->clear( pass2, GL_COLOR_BUFFER_BIT );
+  }
+
+  // Wide outlines: find the pixels near edge pixels.  Nearer flood
+  // outlines are wider, up to four times the set width.  At reduced
+  // size, an edge pixel is about as wide as the 3x3 test's outline,
+  // so that test becomes a dilation of radius 0, i.e. the Laplacian.
+
+  float maxOutlineWidth = 4 * outlineWidth;
+  int outline = laplacian;
+
+  bool dilated = (outlineMode == DILATED_OUTLINES || (outlineMode == NEIGHBOURHOOD_OUTLINES && edgeScale > 1));
+
+  if (dilated) {
+    int radius = (outlineMode == DILATED_OUTLINES ? (int) (outlineWidth / edgeScale + 0.5) : 0);
+    if (radius > 0)
+      outline = dilateEdges( laplacian, depthStencil, radius );
+  } else if (outlineMode == FLOOD_OUTLINES)
+    outline = floodOutlineEdges( laplacian, edgeDepth, maxOutlineWidth / edgeScale );
+
+  int debug2 = showTextures( colour, normal, edgeDepth, laplacian );
+
+  // Pass 3: Draw everything using data from G-Buffers
+
+  // With flood outlines, the width is outlineWidth at the depth of the
+  // model's centre
+
+  float referenceDepth = 0;
+
+  if (outlineMode == FLOOD_OUTLINES) {
+    vec4 c = MVP * vec4( obj->centre.x, obj->centre.y, obj->centre.z, 1 );
+    referenceDepth = (c.w > 0 ? 0.5 * c.z / c.w + 0.5 : 0);
+    if (referenceDepth < 0)
+      referenceDepth = 0;
+    if (referenceDepth > 0.999)
+      referenceDepth = 0.999;
+  }
+
+  bool masked = maskBackground;
+  vec3 lightDirection = lightDir;
+
+  int pass3 = graph->addPass( "pass 3", 2, [=]() {
+
+      GLState::disable( GL_DEPTH_TEST );
+
+      if (masked)
+	maskToCovered();
+
+      pass3Prog->activate();
+
+      pass3Prog->setVec2( "texCoordInc", vec2( 1 / (float) width, 1 / (float) height ) );
+      pass3Prog->setVec3( "lightDir", lightDirection );
+
+      pass3Prog->setInt( "colourSampler",    COLOUR_UNIT );
+      pass3Prog->setInt( "normalSampler",    NORMAL_UNIT );
+      pass3Prog->setInt( "depthSampler",     DEPTH_UNIT );
+      pass3Prog->setInt( "laplacianSampler", LAPLACIAN_UNIT );
+      pass3Prog->setInt( "rampSampler",      RAMP_UNIT );
+      pass3Prog->setInt( "specularSampler",  SPECULAR_UNIT );
+
+      if (rampTexture == 0 || ramp != storedRamp)
+	storeRamp();
 
-  gbuffer->BindForWriting();
+      GLState::bindTexture( RAMP_UNIT, rampTexture );
+      GLState::bindTexture( SPECULAR_UNIT, specularTexture );
+
+      pass3Prog->setInt( "dilatedOutlines", dilated );
+      pass3Prog->setInt( "floodOutlines",   outlineMode == FLOOD_OUTLINES );
+      pass3Prog->setInt( "edgeScale",       edgeScale );
+
+      pass3Prog->setInt( "dilatedEdgeSampler", OUTLINE_UNIT );
+      pass3Prog->setInt( "edgeDepthSampler",   OUTLINE_DEPTH_UNIT );
+
+      pass3Prog->setInt(   "nearestEdgeSampler", OUTLINE_UNIT );
+      pass3Prog->setFloat( "outlineWidth",       outlineWidth );
+      pass3Prog->setFloat( "maxOutlineWidth",    maxOutlineWidth );
+      pass3Prog->setFloat( "referenceDepth",     referenceDepth );
+
+      drawFullscreenQuad();
+
+      pass3Prog->deactivate();
+
+      GLState::disable( GL_STENCIL_TEST );
+    } );
+
+  graph->read( pass3, colour, COLOUR_UNIT );
+  graph->read( pass3, normal, NORMAL_UNIT );
+  graph->read( pass3, depth,  DEPTH_UNIT );
+
+  if (dilated) {
+    graph->read( pass3, outline,   OUTLINE_UNIT );
+    graph->read( pass3, edgeDepth, OUTLINE_DEPTH_UNIT );
+  } else if (outlineMode == FLOOD_OUTLINES)
+    graph->read( pass3, outline, OUTLINE_UNIT );
+  else
+    graph->read( pass3, laplacian, LAPLACIAN_UNIT );
+
+  // Pass 3 makes background pixels white, which is the clear colour.
+  // When masking, it draws only the covered pixels, into an 8-bit
+  // texture (as the stencil is one) that is then copied to the output.
+  // The copy is timed with pass 3, as part of its cost.  Otherwise it
+  // draws every pixel of the output.
+
+  int finalPass = pass3;
+
+  if (masked) {
+
+    int image = graph->createTexture( "image", width, height, GL_RGBA8 );
+
+    graph->write( pass3, image );
+    graph->useDepthStencil( pass3, depthStencil, false );
+    graph->clear( pass3, GL_COLOR_BUFFER_BIT );
+
+    finalPass = graph->addPass( "copy image", 2, [=]() {
+	graph->blit( image, 0, 0, width, height, GL_NEAREST );
+      } );
+
+    graph->read( finalPass, image, -1 );
+    graph->output( finalPass, outputFBO, width, height );
+
+  } else
+
+    graph->output( pass3, outputFBO, width, height );
+
+  graph->execute( debug == 1 ? debug1 : debug == 2 ? debug2 : finalPass );
+}
+
+
+// Pass 1 for the model's instances, culled on the GPU or the CPU.
+// On the GPU, the instances that last frame's depth hid are checked
+// again against the depth drawn here ('depthTexture', which is being
+// drawn into), and drawn if they show.
+
+void Renderer::drawModel( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, GLuint depthTexture )
+
+{
+  culled = (gpuCulling && !separateInstances && culler->cull( obj, MVP ));
 
   pass1Prog->activate();
 
-  pass1Prog->setMat4(  "M",        M );
-  pass1Prog->setMat4(  "MV",       MV );
-  pass1Prog->setMat4(  "MVP",      MVP );
+  GLState::enable( GL_DEPTH_TEST );
 
-  gbuffer->BindTexture( COLOUR_GBUFFER );
-  gbuffer->BindTexture( NORMAL_GBUFFER );
-  gbuffer->BindTexture( DEPTH_GBUFFER  );
+  GLState::enable( GL_STENCIL_TEST );
+  glStencilFunc( GL_ALWAYS, 1, 0xFF );
+  glStencilOp( GL_KEEP, GL_KEEP, GL_REPLACE );
 
-  int activeDrawBuffers1[] = { COLOUR_GBUFFER, NORMAL_GBUFFER, DEPTH_GBUFFER };
-  gbuffer->setDrawBuffers( 3, activeDrawBuffers1 );
+  if (!separateInstances) {
 
-  glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
-  glEnable( GL_DEPTH_TEST );
+    pass1Prog->setMat4(  "M",        M );
+    pass1Prog->setMat4(  "MV",       MV );
+    pass1Prog->setMat4(  "MVP",      MVP );
 
-  obj->draw( pass1Prog );
+    if (culled) {
+
+      culler->draw( obj, pass1Prog );
+
+      if (culler->recheck( depthTexture, width, height, MVP )) {
+	pass1Prog->activate();
+	culler->draw( obj, pass1Prog );
+      }
+
+    } else
+      obj->draw( pass1Prog, MVP );
+
+  } else
+
+    // One copy at a time, with its transform in the uniforms, as
+    // without instancing
+
+    for (int i=0; i<obj->getNumInstances(); i++) {
+
+      mat4 &T = obj->instanceTransform( i );
+      mat4 MT = M * T, MVT = MV * T, MVPT = MVP * T;
+
+      pass1Prog->setMat4(  "M",        MT );
+      pass1Prog->setMat4(  "MV",       MVT );
+      pass1Prog->setMat4(  "MVP",      MVPT );
+
+      obj->draw( pass1Prog, MVPT, false );
+    }
 
   pass1Prog->deactivate();
 
-  if (debug == 1) {
-    gbuffer->DrawGBuffers();
-    return;
+  GLState::disable( GL_STENCIL_TEST );
+}
+
+
+// Debugging output: up to four textures, one in each quarter of the
+// output (-1 = leave that quarter empty).  Returns the pass.
+
+int Renderer::showTextures( int lowerLeft, int upperLeft, int upperRight, int lowerRight )
+
+{
+  int textures[4] = { lowerLeft, upperLeft, upperRight, lowerRight };
+
+  int show = graph->addPass( "show textures", -1, [=]() {
+
+      int halfWidth = width / 2;
+      int halfHeight = height / 2;
+
+      int x0[4] = { 0,         0,          halfWidth,  halfWidth };
+      int y0[4] = { 0,         halfHeight, halfHeight, 0 };
+      int x1[4] = { halfWidth, halfWidth,  width,      width };
+      int y1[4] = { halfHeight, height,    height,     halfHeight };
+
+      for (int i=0; i<4; i++)
+	if (textures[i] >= 0)
+	  graph->blit( textures[i], x0[i], y0[i], x1[i], y1[i], GL_LINEAR );
+    } );
+
+  for (int i=0; i<4; i++)
+    if (textures[i] >= 0)
+      graph->read( show, textures[i], -1 );
+
+  graph->output( show, outputFBO, width, height );
+  graph->clear( show, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+  return show;
+}
+
+
+// Make the cel shading textures from 'ramp'.  Each is one texel
+// high.
+
+void Renderer::storeRamp()
+
+{
+  PROFILE_ZONE( "Renderer::storeRamp" );
+
+  float *bands = new float[ 3 * ToonRamp::SIZE_N ];
+  float *specular = new float[ ToonRamp::SIZE_S ];
+
+  ramp.makeBands( bands );
+  ramp.makeSpecular( specular );
+
+  if (rampTexture == 0) {
+
+    glGenTextures( 1, &rampTexture );
+    GLState::bindTexture( RAMP_UNIT, rampTexture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB16F, ToonRamp::SIZE_N, 1, 0, GL_RGB, GL_FLOAT, bands );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    glGenTextures( 1, &specularTexture );
+    GLState::bindTexture( SPECULAR_UNIT, specularTexture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_R16F, ToonRamp::SIZE_S, 1, 0, GL_RED, GL_FLOAT, specular );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+  } else {
+
+    GLState::bindTexture( RAMP_UNIT, rampTexture );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, ToonRamp::SIZE_N, 1, GL_RGB, GL_FLOAT, bands );
+
+    GLState::bindTexture( SPECULAR_UNIT, specularTexture );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, ToonRamp::SIZE_S, 1, GL_RED, GL_FLOAT, specular );
   }
 
-  // Pass 2: Store Laplacian (computed from depths) in G-Buffer
+  delete [] bands;
+  delete [] specular;
+
+  storedRamp = ramp;
+}
 
-  pass2Prog->activate();
 
-  pass2Prog->setVec2( "texCoordInc", vec2( 1 / (float) windowWidth, 1 / (float) windowHeight ) );
+// Make the depth for reduced-size edges: each of its pixels gets the
+// nearest and farthest depths of the edgeScale x edgeScale pixels
+// that it covers
 
-  pass2Prog->setInt( "depthSampler", DEPTH_GBUFFER );
+int Renderer::downsampleDepth( int depth )
 
-  gbuffer->BindTexture( LAPLACIAN_GBUFFER );
+{
+  int edgeDepth = graph->createTexture( "edge depth", edgeWidth, edgeHeight );
 
-  int activeDrawBuffers2[] = { LAPLACIAN_GBUFFER };
-  gbuffer->setDrawBuffers( 1, activeDrawBuffers2 );
+  int pass = graph->addPass( "downsample depth", 1, [=]() {
 
-  glClear( GL_COLOR_BUFFER_BIT );
-  glDisable( GL_DEPTH_TEST );
+      downsampleProg->activate();
 
-  drawFullscreenQuad();
+      downsampleProg->setInt( "depthSampler", DEPTH_UNIT );
+      downsampleProg->setInt( "scale",        edgeScale );
 
-  pass2Prog->deactivate();
+      GLState::disable( GL_DEPTH_TEST );
 
-  if (debug == 2) {
-    gbuffer->DrawGBuffers();
-    return;
+      drawFullscreenQuad();
+
+      downsampleProg->deactivate();
+    } );
+
+  graph->read( pass, depth, DEPTH_UNIT );
+  graph->write( pass, edgeDepth );
+
+  return edgeDepth;
+}
+
+
+// Find each pixel's nearest edge pixel (one with a negative enough
+// Laplacian), if there is one within maxWidth pixels, by jump
+// flooding.  That takes a seed pass and log2(maxWidth) flood passes,
+// each of which looks at nine pixels, whatever the width.  Each pass
+// writes a new texture, but the graph gives them only two.
+
+int Renderer::floodOutlineEdges( int laplacian, int edgeDepth, float maxWidth )
+
+{
+  // Seed with the edge pixels
+
+  int nearest = graph->createTexture( "flood seeds", edgeWidth, edgeHeight );
+
+  int seed = graph->addPass( "flood seeds", 1, [=]() {
+
+      seedProg->activate();
+
+      seedProg->setInt( "laplacianSampler", LAPLACIAN_UNIT );
+      seedProg->setInt( "depthSampler",     DEPTH_UNIT );
+
+      drawFullscreenQuad();
+
+      seedProg->deactivate();
+    } );
+
+  graph->read( seed, laplacian, LAPLACIAN_UNIT );
+  graph->read( seed, edgeDepth, DEPTH_UNIT );
+  graph->write( seed, nearest );
+
+  // Flood with steps of n/2, n/4, ..., 1 for a power of two n >= maxWidth
+
+  int n = 1;
+  while (n < maxWidth)
+    n *= 2;
+
+  for (int step=n/2; step>=1; step/=2) {
+
+    int next = graph->createTexture( "flood", edgeWidth, edgeHeight );
+
+    int flood = graph->addPass( "flood", 1, [=]() {
+
+	floodProg->activate();
+
+	floodProg->setVec2( "texCoordInc", vec2( 1 / (float) edgeWidth, 1 / (float) edgeHeight ) );
+	floodProg->setInt( "nearestEdgeSampler", EDGE_UNIT );
+	floodProg->setFloat( "stepSize", step );
+
+	drawFullscreenQuad();
+
+	floodProg->deactivate();
+      } );
+
+    graph->read( flood, nearest, EDGE_UNIT );
+    graph->write( flood, next );
+
+    nearest = next;
   }
 
-  // Pass 3: Draw everything using data from G-Buffers
+  return nearest;
+}
 
-  glBindFramebuffer( GL_DRAW_FRAMEBUFFER, 0 );
-  glClear( GL_COLOR_BUFFER_BIT );
-  glDisable( GL_DEPTH_TEST );
 
-  pass3Prog->activate();
+// Spread the edges 'radius' pixels in x and y.  Each pixel gets the
+// minimum Laplacian in the square around it, first along its row and
+// then along its column, which is 2(2r+1) reads rather than (2r+1)^2.
+// Pass 3 reads only the covered pixels, so the column pass is masked
+// like pass 2; the row pass is not, as the column pass reads it
+// above and below covered pixels.
 
-  pass3Prog->setVec2( "texCoordInc", vec2( 1 / (float) windowWidth, 1 / (float) windowHeight ) );
-  pass3Prog->setVec3( "lightDir", lightDir );
+int Renderer::dilateEdges( int laplacian, int depthStencil, int radius )
 
-  pass3Prog->setInt( "colourSampler",    COLOUR_GBUFFER );
-  pass3Prog->setInt( "normalSampler",    NORMAL_GBUFFER );
-  pass3Prog->setInt( "depthSampler",     DEPTH_GBUFFER );
-  pass3Prog->setInt( "laplacianSampler", LAPLACIAN_GBUFFER );
+{
+  int rows    = graph->createTexture( "dilated rows",  edgeWidth, edgeHeight );
+  int dilated = graph->createTexture( "dilated edges", edgeWidth, edgeHeight );
+
+  bool masked = (maskBackground && edgeScale == 1);
+
+  // Rows
+
+  int rowPass = graph->addPass( "dilate rows", 1, [=]() {
+
+      dilateProg->activate();
+
+      dilateProg->setInt( "radius", radius );
+      dilateProg->setInt( "edgeSampler", EDGE_UNIT );
+      dilateProg->setVec2( "texCoordStep", vec2( 1 / (float) edgeWidth, 0 ) );
+
+      drawFullscreenQuad();
+
+      dilateProg->deactivate();
+    } );
+
+  graph->read( rowPass, laplacian, EDGE_UNIT );
+  graph->write( rowPass, rows );
+
+  // Columns
+
+  int columnPass = graph->addPass( "dilate columns", 1, [=]() {
+
+      dilateProg->activate();
 
-  gbuffer->BindTexture( COLOUR_GBUFFER );
-  gbuffer->BindTexture( NORMAL_GBUFFER );
-  gbuffer->BindTexture( DEPTH_GBUFFER );
-  gbuffer->BindTexture( LAPLACIAN_GBUFFER  );
+      dilateProg->setInt( "radius", radius );
+      dilateProg->setInt( "edgeSampler", EDGE_UNIT );
+      dilateProg->setVec2( "texCoordStep", vec2( 0, 1 / (float) edgeHeight ) );
 
-  drawFullscreenQuad();
+      if (masked)
+	maskToCovered();
+
+      drawFullscreenQuad();
+
+      GLState::disable( GL_STENCIL_TEST );
+
+      dilateProg->deactivate();
+    } );
+
+  graph->read( columnPass, rows, EDGE_UNIT );
+  graph->write( columnPass, dilated );
+
+  if (masked)
+    graph->useDepthStencil( columnPass, depthStencil, false );
+
+  return dilated;
+}
+
+
+// Counts like 12345678 as "12.3M"
+
+static void shortCount( char *buffer, double n )
+
+{
+  if (n >= 1e6)
+    sprintf( buffer, "%.1fM", n / 1e6 );
+  else if (n >= 1e3)
+    sprintf( buffer, "%.0fk", n / 1e3 );
+  else
+    sprintf( buffer, "%.0f", n );
+}
+
+
+// The status line, with the GPU time of each pass and the vertices,
+// primitives and fragments of the whole frame, from a few frames ago
+
+void Renderer::makeStatusMessage( char *buffer, bool showPassStats )
+
+{
+  if (debug == 0)
+    sprintf( buffer, "Program output" );
+  else
+    sprintf( buffer, "After pass %d", debug );
+
+  if (gpuCulling)
+    strcat( buffer, "  GPU culling" );
+
+  if (maskBackground)
+    strcat( buffer, "  masked" );
+
+  if (edgeScale > 1)
+    sprintf( buffer + strlen(buffer), "  edges at 1/%d", edgeScale );
+
+  if (outlineMode == DILATED_OUTLINES)
+    sprintf( buffer + strlen(buffer), "  dilated outlines %.0f px", outlineWidth );
+  else if (outlineMode == FLOOD_OUTLINES)
+    sprintf( buffer + strlen(buffer), "  flood outlines %.0f px", outlineWidth );
+
+  if (ramp != ToonRamp())
+    sprintf( buffer + strlen(buffer), "  %d quanta%s", ramp.numQuanta,
+	     ramp.specularThreshold > 0 ? ", hard highlight" : "" );
+
+  if (!showPassStats || !timer->hasResults())
+    return;
+
+  double vertices = 0, primitives = 0, fragments = 0;
+
+  strcat( buffer, "  GPU" );
+
+  for (int p=0; p<3; p++) {
+
+    PassStats &st = timer->stats( p );
+
+    if (!st.measured)
+      continue;
+
+    sprintf( buffer + strlen(buffer), "%s%.2f", (p == 0 ? " " : "+"), st.ms );
+
+    vertices += st.vertices;
+    primitives += st.primitives;
+    fragments += st.fragments;
+  }
+
+  strcat( buffer, " ms" );
+
+  if (timer->hasPipelineStats()) {
+    char v[20], p[20], f[20];
+    shortCount( v, vertices );
+    shortCount( p, primitives );
+    shortCount( f, fragments );
+    sprintf( buffer + strlen(buffer), "  %s vert %s prim %s frag", v, p, f );
+
+    // Fragments of the masked passes, against the width x height
+    // each would run unmasked, and the pixels that masking pass 3
+    // adds in its copy to the output.  Timer pass 1 holds pass 2 alone
+    // only with full-size neighbourhood outlines; otherwise it also
+    // holds the outline passes, so only pass 3 is counted.
+
+    if (maskBackground) {
+
+      int first = (edgeScale == 1 && outlineMode == NEIGHBOURHOOD_OUTLINES ? 1 : 2);
+      double run = 0, unmasked = 0;
+
+      for (int p=first; p<3; p++)
+	if (timer->stats( p ).measured) {
+	  run += timer->stats( p ).fragments;
+	  unmasked += (double) width * height;
+	}
+
+      if (unmasked > 0) {
+	char r[20], u[20], c[20];
+	shortCount( r, run );
+	shortCount( u, unmasked );
+	shortCount( c, (double) width * height );
+	sprintf( buffer + strlen(buffer), "  %s %s of %s frag (%.0f%% saved) + %s px copied",
+		 (first == 1 ? "passes 2+3" : "pass 3"), r, u, 100 * (1 - run / unmasked), c );
+      }
+    }
+  }
 
-  pass3Prog->deactivate();
+  sprintf( buffer + strlen(buffer), "  %.0f MB targets  GL state %d set %d skipped",
+	   graph->textureMemory() / (double) (1 << 20), GLState::issued(), GLState::skipped() );
 }
@@ -6,56 +6,179 @@
 
 #include "wavefront.h"
 #include "gpuProgram.h"
-#include "gbuffer.h"
+#include "gpuTimer.h"
+#include "gpuCuller.h"
+#include "toonRamp.h"
+#include "renderGraph.h"
 
 
 class Renderer {
 
-  enum { COLOUR_GBUFFER,
-	 NORMAL_GBUFFER,
-	 DEPTH_GBUFFER,
-	 LAPLACIAN_GBUFFER,
-	 NUM_GBUFFERS };
+  // Texture units of the samplers
+
+  enum { COLOUR_UNIT,
+	 NORMAL_UNIT,
+	 DEPTH_UNIT,
+	 LAPLACIAN_UNIT,
+	 EDGE_UNIT,		// input of the outline passes
+	 OUTLINE_UNIT = 8,	// pass 3's outline textures, which may be at
+	 OUTLINE_DEPTH_UNIT,	// reduced size (unit 7 is GPUCuller's)
+	 RAMP_UNIT,		// and its cel shading: bands along N.L
+	 SPECULAR_UNIT };	// and the highlight along R.V
 
   GPUProgram *pass1Prog, *pass2Prog, *pass3Prog;
-  GBuffer    *gbuffer;
+  GPUProgram *seedProg, *floodProg;	// flood outlines
+  GPUProgram *dilateProg;		// dilated outlines
+  GPUProgram *downsampleProg;		// depth for reduced-size edges
+
+  RenderGraph *graph;		// each frame's passes, and their textures
+
+  // Pass 2 and the outline passes work at 1/edgeScale of the window
+  // size
+
+  int edgeScale;
+  int edgeWidth, edgeHeight;
+
+  GPUTimer   *timer;		// GPU time and statistics of each pass
+  GPUCuller  *culler;		// NULL if OpenGL can't cull on the GPU
+  bool        culled;		// this frame's instances were culled by it
+
+  GLuint   rampTexture;		// 'ramp' as it was when last stored: bands
+  GLuint   specularTexture;	// and highlight
+  ToonRamp storedRamp;
+
+  void storeRamp();
+
+  void drawModel( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, GLuint depthTexture );
+
+  // These add passes to the graph, and return the texture with their
+  // result
+
+  int  downsampleDepth( int depth );
+  int  floodOutlineEdges( int laplacian, int edgeDepth, float maxWidth );
+  int  dilateEdges( int laplacian, int depthStencil, int radius );
+
+  int  showTextures( int lowerLeft, int upperLeft, int upperRight, int lowerRight );
+
+  int    width, height;		// window size
+  GLuint outputFBO;		// framebuffer that pass 3 draws into (0 = window)
 
  public:
 
   int debug;
 
+  bool separateInstances;	// draw each instance of a model with its own draw call and uniforms
+  bool gpuCulling;		// cull with the culler, not on the CPU
+  bool maskBackground;		// passes 2 and 3 skip pixels that pass 1 didn't cover
+
+  // How pass 3 finds the pixels near edges, which it makes black.
+  // With DILATED_OUTLINES, outlineWidth is the radius of the
+  // dilation.  With FLOOD_OUTLINES, it is the width in pixels at the
+  // depth of the model's centre, and nearer outlines are wider.
+
+  enum OutlineMode { NEIGHBOURHOOD_OUTLINES,	// pass 3 tests the 3x3 neighbourhood
+		     DILATED_OUTLINES,		// separable dilation of the edges
+		     FLOOD_OUTLINES,		// jump flood of the edges
+		     NUM_OUTLINE_MODES };
+
+  OutlineMode outlineMode;
+  float       outlineWidth;
+
+  ToonRamp ramp;		// pass 3's cel shading; changes are stored at the next render()
+
   Renderer( int windowWidth, int windowHeight ) {
-    gbuffer = new GBuffer( windowWidth, windowHeight, NUM_GBUFFERS );
+    width = windowWidth;
+    height = windowHeight;
+    outputFBO = 0;
     pass1Prog = new GPUProgram( "shaders/pass1.vert", "shaders/pass1.frag" );
     pass2Prog = new GPUProgram( "shaders/pass2.vert", "shaders/pass2.frag" );
     pass3Prog = new GPUProgram( "shaders/pass3.vert", "shaders/pass3.frag" );
+    seedProg  = new GPUProgram( "shaders/pass2.vert", "shaders/outlineSeed.frag" );
+    floodProg = new GPUProgram( "shaders/pass2.vert", "shaders/outlineFlood.frag" );
+    dilateProg = new GPUProgram( "shaders/pass2.vert", "shaders/dilateEdges.frag" );
+    downsampleProg = new GPUProgram( "shaders/pass2.vert", "shaders/downsampleDepth.frag" );
+    timer = new GPUTimer( 3 );
+    graph = new RenderGraph( timer );
+    culler = (GPUCuller::supported() ? new GPUCuller() : NULL);
     debug = 0;
+    separateInstances = false;
+    gpuCulling = (culler != NULL);
+    maskBackground = true;
+    outlineMode = NEIGHBOURHOOD_OUTLINES;
+    outlineWidth = 4;
+    edgeScale = 1;
+    culled = false;
+    rampTexture = 0;
+    specularTexture = 0;
   }
 
   ~Renderer() {
-    delete gbuffer;
+    if (rampTexture != 0) {
+      glDeleteTextures( 1, &rampTexture );
+      glDeleteTextures( 1, &specularTexture );
+      GLState::forget();
+    }
+    delete culler;
+    delete graph;
+    delete timer;
+    delete downsampleProg;
+    delete dilateProg;
+    delete floodProg;
+    delete seedProg;
     delete pass3Prog;
     delete pass2Prog;
     delete pass1Prog;
   }
 
   void reshape( int windowWidth, int windowHeight ) {
-    delete gbuffer;
-    gbuffer = new GBuffer( windowWidth, windowHeight, NUM_GBUFFERS );
+    width = windowWidth;
+    height = windowHeight;
+    if (culler != NULL)
+      culler->forgetDepth();
+  }
+
+  // Send the final image to a framebuffer object instead of the
+  // window, e.g. when there is no window (batch rendering)
+
+  void setOutputFramebuffer( GLuint fbo ) {
+    outputFBO = fbo;
   }
 
   void render( wfModel *obj, mat4 &M, mat4 &MV, mat4 &MVP, vec3 &lightDir );
 
+  // Write the GPU time and statistics of every pass to a CSV file
+
+  void logPassStats( char *filename ) {
+    timer->openLog( filename );
+  }
+
+  PassStats &passStats( int pass ) {
+    return timer->stats( pass );
+  }
+
+  void toggleGPUCulling() {
+    gpuCulling = !gpuCulling && culler != NULL;
+  }
+
+  void nextOutlineMode() {
+    outlineMode = (OutlineMode) ((outlineMode+1) % NUM_OUTLINE_MODES);
+  }
+
+  // Find edges at full size, 1/2 size, or 1/4 size
+
+  void nextEdgeScale() {
+    edgeScale = (edgeScale == 4 ? 1 : 2 * edgeScale);
+  }
+
+  int getEdgeScale() {
+    return edgeScale;
+  }
+
   void incDebug() {
     debug = (debug+1) % 3;
   }
 
-  void makeStatusMessage( char *buffer ) {
-    if (debug == 0)
-      sprintf( buffer, "Program output" );
-    else
-      sprintf( buffer, "After pass %d", debug );
-  }
+  void makeStatusMessage( char *buffer, bool showPassStats = true );
 };
 
 #endif
@@ -7,16 +7,39 @@
 #include "linalg.h"
 #include "wavefront.h"
 #include "renderer.h"
+#include "cpuRenderer.h"
 #include "font.h"
+#include "shader.h"
+#include "batch.h"
+#include "instanceBench.h"
+#include "profiler.h"
+#include "frameScheduler.h"
+#include "frameCache.h"
+#include "modelLoader.h"
 
 
-wfModel *obj;			// the object
+wfModel *obj = NULL;		// the object (NULL until the first one is loaded)
+
+ModelLoader *modelLoader;	// loads models in the background
+seq<char*>   modelFiles;	// models to show, in turn, with 'n'
+int          currentModelFile = 0;
+int          numInstances = 1;	// copies of each model
 
 Renderer *renderer;		// class to do multipass rendering
 
+ThreadPool  *threadPool;	// threads for the CPU renderer and texture loading
+CPURenderer *cpuRenderer;	// software version of the renderer, for reference
+bool useCPURenderer = false;	// toggled with 'c'
+
+char *traceFile = (char *) "trace.json"; // profile written here with 't'
+
 float theta = 0;
 bool sleeping = false;
 
+FrameScheduler *scheduler;	// frame pacing; 'v' changes the mode
+FrameCache     *frameCache;	// last frame, shown again if nothing has changed
+bool            idleRunning = true;	// idle() is registered with GLUT
+
 GLuint windowWidth = 600;
 GLuint windowHeight = 450;
 float factor = 0;
@@ -28,19 +51,73 @@ vec3 eyePosition;
 
 
 bool isTorso = false;		// for torso.obj model
+float sceneRadius;		// radius of all instances of the model
+
+
+// Everything that the rendered image depends on
+
+class ViewState {
+ public:
+  wfModel *obj;
+  vec3     eyePosition;
+  float    fovy, theta, factor;
+  int      debug;
+  bool     useCPU, gpuCulling, maskBackground;
+  int      outlineMode, edgeScale;
+  float    outlineWidth;
+  ToonRamp ramp;
+  int      width, height;
+
+  bool operator == ( const ViewState &v ) const {
+    return obj == v.obj && eyePosition.x == v.eyePosition.x && eyePosition.y == v.eyePosition.y &&
+      eyePosition.z == v.eyePosition.z && fovy == v.fovy && theta == v.theta && factor == v.factor &&
+      debug == v.debug && useCPU == v.useCPU && gpuCulling == v.gpuCulling &&
+      maskBackground == v.maskBackground && outlineMode == v.outlineMode && edgeScale == v.edgeScale &&
+      outlineWidth == v.outlineWidth && ramp == v.ramp && width == v.width && height == v.height;
+  }
+};
 
+ViewState drawnView;		// view in the frame cache
 
-void display()
+
+ViewState currentView()
 
 {
-  glClearColor( 1.0, 1.0, 1.0, 0.0 );
-  glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+  ViewState v;
+
+  v.obj = obj;
+  v.eyePosition = eyePosition;
+  v.fovy = fovy;
+  v.theta = theta;
+  v.factor = factor;
+  v.debug = renderer->debug;
+  v.useCPU = useCPURenderer;
+  v.gpuCulling = renderer->gpuCulling;
+  v.maskBackground = renderer->maskBackground;
+  v.outlineMode = renderer->outlineMode;
+  v.edgeScale = renderer->getEdgeScale();
+  v.outlineWidth = renderer->outlineWidth;
+  v.ramp = renderer->ramp;
+  v.width = windowWidth;
+  v.height = windowHeight;
+
+  return v;
+}
 
-  glEnable( GL_DEPTH_TEST );
 
-  // OCS-to-WCS
+bool isTorsoModel( const char *filename )
+
+{
+  return (strlen(filename) >= 9 && strcmp( &filename[strlen(filename)-9] , "torso.obj" ) == 0);
+}
 
-  mat4 M;
+
+void modelTransforms( wfModel *obj, float theta, bool isTorso,
+		      vec3 eyePosition, float fovy, float aspect,
+		      mat4 &M, mat4 &MV, mat4 &MVP, float sceneRadius )
+
+{
+  // OCS-to-WCS
 
   if (isTorso)
     M = rotate( theta, vec3(0,1,0) )
@@ -52,16 +129,63 @@ void display()
 
   // model-view transform (i.e. OCS-to-VCS)
 
-  mat4 MV = translate( -1 * eyePosition )
-          * M;
+  MV = translate( -1 * eyePosition )
+     * M;
 
   // model-view-projection transform (i.e. OCS-to-CCS)
 
-  float n = (eyePosition - obj->centre).length() - obj->radius;
-  float f = (eyePosition - obj->centre).length() + obj->radius;
+  // The near and far planes enclose the scene, which is larger than
+  // the model if there are several instances
+
+  if (sceneRadius == 0)
+    sceneRadius = obj->radius;
+
+  float n = (eyePosition - obj->centre).length() - sceneRadius;
+  float f = (eyePosition - obj->centre).length() + sceneRadius;
+
+  MVP = perspective( fovy, aspect, n, f )
+      * MV;
+}
+
+
+float instanceGrid( wfModel *obj, int n, mat4 *transforms )
+
+{
+  int side = (int) ceil( sqrt( (float) n ) );
+  float spacing = 2.2 * obj->radius;
+
+  srand( 1 );
+
+  for (int i=0; i<n; i++) {
+
+    float x = (i % side - 0.5 * (side-1)) * spacing;
+    float y = (i / side - 0.5 * (side-1)) * spacing;
+
+    // Each copy turned by a random angle about its own centre
+
+    transforms[i] = translate( x, y, 0 )
+                  * translate( obj->centre )
+                  * rotate( 2 * M_PI * randIn01(), vec3(0,1,0) )
+                  * translate( -1 * obj->centre );
+  }
+
+  return 0.5 * sqrt(2.0) * (side-1) * spacing + obj->radius;
+}
+
 
-  mat4 MVP = perspective( fovy, windowWidth / (float) windowHeight, n, f )
-           * MV;
+// Render the current view into the window's back buffer
+
+void drawFrame()
+
+{
+  glClearColor( 1.0, 1.0, 1.0, 0.0 );
+  glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+  GLState::enable( GL_DEPTH_TEST );
+
+  mat4 M, MV, MVP;
+
+  modelTransforms( obj, theta, isTorso, eyePosition, fovy, windowWidth / (float) windowHeight, M, MV, MVP, sceneRadius );
 
   // Light direction in VCS is above, to the right, and behind the
   // eye.  That's in direction (1,1,1) since the view direction is
@@ -72,69 +196,183 @@ void display()
 
   // Draw the objects
 
-  renderer->render( obj, M, MV, MVP, lightDir );
+  if (useCPURenderer) {
+
+    cpuRenderer->debug = renderer->debug;
+    cpuRenderer->ramp = renderer->ramp;
+    cpuRenderer->render( obj, M, MV, MVP, lightDir );
+
+    GLState::disable( GL_DEPTH_TEST );
+    GLState::useProgram( 0 );
+    glWindowPos2i( 0, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glDrawPixels( windowWidth, windowHeight, GL_RGB, GL_UNSIGNED_BYTE, cpuRenderer->pixels() );
+
+  } else
+
+    renderer->render( obj, M, MV, MVP, lightDir );
+}
+
+
+// Swap in a newly loaded model, finishing it in this thread's OpenGL
+// context, and point the camera at it
+
+void showModel( wfModel *model, char *filename )
+
+{
+  PROFILE_ZONE( "showModel" );
+
+  model->setupVAO();
+
+  if (numInstances > 1) {
+    mat4 *transforms = new mat4[ numInstances ];
+    sceneRadius = instanceGrid( model, numInstances, transforms );
+    model->setInstances( numInstances, transforms );
+    delete [] transforms;
+  } else
+    sceneRadius = model->radius;
+
+  cpuRenderer->forgetModel();
+  delete obj;
+
+  obj = model;
+  isTorso = isTorsoModel( filename );
+
+  const float initEyeDistance = 5.0;
+
+  eyePosition = (initEyeDistance * sceneRadius) * vec3(0,0,1);
+  fovy = 2 * atan2( 1, initEyeDistance );
+
+  frameCache->valid = false;	// a new model may have the old one's address
+
+  free( filename );
+}
+
+
+void display()
+
+{
+  PROFILE_ZONE( "display" );
+
+  scheduler->frameStarted();
+
+  wfModel *loadedModel;
+  char    *loadedFilename;
+
+  if (modelLoader->take( loadedModel, loadedFilename ))
+    showModel( loadedModel, loadedFilename );
+
+  // Nothing changed: show the last frame again
+
+  ViewState view = currentView();
+
+  if (obj == NULL) {
+    glClearColor( 1.0, 1.0, 1.0, 0.0 );
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+  } else if (frameCache->valid && view == drawnView)
+    frameCache->present();
+  else {
+    drawFrame();
+
+    // Copying the window costs a full-window blit, so keep it only
+    // once a view has been drawn twice: the next frame is then likely
+    // to be the same, and nothing that the first frame of the view
+    // left out is missing from the copy.  Until then idle() keeps
+    // drawing, even when paused.
+
+    if (view == drawnView)
+      frameCache->store( windowWidth, windowHeight );
+    else
+      frameCache->valid = false;
+
+    drawnView = view;
+  }
 
   // Output status message
 
   char buffer[1000];
-  renderer->makeStatusMessage( buffer );
+
+  if (obj != NULL)
+    renderer->makeStatusMessage( buffer, !useCPURenderer );
+  else
+    buffer[0] = '\0';
+
+  if (useCPURenderer)
+    strcat( buffer, " (CPU)" );
+  if (modelLoader->pending() > 0)
+    snprintf( buffer + strlen(buffer), sizeof(buffer) - strlen(buffer), "  loading %s", modelFiles[ currentModelFile ] );
   glColor3f(0.3,0.3,1.0);
   printString( buffer, 10, 10, windowWidth, windowHeight );
 
+  scheduler->makeStatusMessage( buffer );
+  printString( buffer, 10, 28, windowWidth, windowHeight );
+
   // Done
 
+  PROFILE_ZONE( "glutSwapBuffers" );
+
   glutSwapBuffers();
+
+  scheduler->frameFinished();
 }
 
 
-// Reshape the window
+// Update the object angle upon idle.  The scheduler decides when the
+// next frame starts.
+//
+// When paused with nothing changed, stop calling idle() altogether
+// until an event changes something (see wakeUp()).  Until then the
+// window is redrawn only when GLUT asks, from the frame cache.
 
 
-void reshape( int newWidth, int newHeight )
+void idle()
 
 {
-  windowWidth = newWidth;
-  windowHeight = newHeight;
+  scheduler->waitForNextFrame();
 
-  glViewport( 0, 0, newWidth, newHeight );
-
-  renderer->reshape( newWidth, newHeight );
-}
+  // Set angle based on elapsed time
 
+  if (!sleeping)
+    theta = scheduler->seconds() * 0.3;
+  else if (frameCache->valid && currentView() == drawnView && modelLoader->pending() == 0) {
+    glutIdleFunc( NULL );
+    idleRunning = false;
+    return;
+  }
 
+  glutPostRedisplay();
+}
 
-// Update the object angle upon idle
 
+// Restart idle() after an event that may have changed the view
 
-void idle()
+void wakeUp()
 
 {
-  // Determine time elapsed from start
+  if (!idleRunning) {
+    glutIdleFunc( idle );
+    idleRunning = true;
+  }
 
-  static bool firstTime = true;
-  static struct timeb startTime;
+  glutPostRedisplay();
+}
 
-  if (firstTime) {
-    ftime( &startTime );
-    firstTime = false;
-  }
 
-  struct timeb thisTime;
-  ftime( &thisTime );
-  float elapsedTime = (thisTime.time + thisTime.millitm / 1000.0) - (startTime.time + startTime.millitm / 1000.0);
+// Reshape the window
 
-  // Set angle based on elapsed time
 
-  if (!sleeping)
-    theta = elapsedTime * 0.3;
+void reshape( int newWidth, int newHeight )
 
-  // Wait a bit
+{
+  windowWidth = newWidth;
+  windowHeight = newHeight;
 
-#ifdef LINUX
-  usleep(10000);
-#endif
+  GLState::viewport( 0, 0, newWidth, newHeight );
 
-  glutPostRedisplay();
+  renderer->reshape( newWidth, newHeight );
+  cpuRenderer->reshape( newWidth, newHeight );
+
+  wakeUp();
 }
 
 
@@ -152,6 +390,51 @@ void keyPress( unsigned char key, int x, int y )
   case 'd':
     renderer->incDebug();
     break;
+  case 'c':
+    useCPURenderer = !useCPURenderer;
+    break;
+  case 'v':
+    scheduler->nextMode();
+    break;
+  case 'g':
+    renderer->toggleGPUCulling();
+    break;
+  case 'm':
+    renderer->maskBackground = !renderer->maskBackground;
+    break;
+  case 'o':
+    renderer->nextOutlineMode();
+    break;
+  case 'h':
+    renderer->nextEdgeScale();
+    break;
+  case 'q':
+    renderer->ramp.nextNumQuanta();
+    break;
+  case 'b':
+    renderer->ramp.toggleSpecularBand();
+    break;
+  case 'n':			// load the next model (or reload the only one)
+    currentModelFile = (currentModelFile + 1) % modelFiles.size();
+    modelLoader->load( modelFiles[ currentModelFile ] );
+    break;
+  case '+':
+  case '=':
+    renderer->outlineWidth += 1;
+    break;
+  case '-':
+    if (renderer->outlineWidth > 1)
+      renderer->outlineWidth -= 1;
+    break;
+  case 't':
+    if (!Profiler::isRecording()) {
+      Profiler::start();
+      cerr << "Profiling started; press 't' again to write '" << traceFile << "'" << endl;
+    } else {
+      Profiler::stop();
+      Profiler::writeTrace( traceFile );
+    }
+    break;
   case 'F':
     factor += 0.01;
     cout << "factor = " << factor << endl;
@@ -161,6 +444,8 @@ void keyPress( unsigned char key, int x, int y )
     cout << "factor = " << factor << endl;
     break;
   }
+
+  wakeUp();
 }
 
 
@@ -182,7 +467,7 @@ void specialKeyPress( int key, int x, int y )
     break;
   }
 
-  glutPostRedisplay();
+  wakeUp();
 }
 
 
@@ -192,15 +477,62 @@ void specialKeyPress( int key, int x, int y )
 int main( int argc, char **argv )
 
 {
+  if (argc > 1 && strcmp( argv[1], "-batch" ) == 0)
+    return runBatch( argc, argv );
+
+  if (argc > 1 && strcmp( argv[1], "-instbench" ) == 0)
+    return runInstanceBench( argc, argv );
+
   if (argc < 2) {
-    cerr << "Usage: " << argv[0] << " scene.obj" << endl;
+    cerr << "Usage: " << argv[0] << " scene.obj [-model another.obj ...] [-instances n] [-cpucull] [-compress] [-fps n | -vsync | -uncapped] [-gpulog file.csv] [-trace file.json]" << endl
+	 << "       " << argv[0] << " -batch list.txt [options]" << endl
+	 << "       " << argv[0] << " -instbench scene.obj [options]" << endl;
     exit(1);
   }
 
+  Profiler::setThreadName( "main" );
+
   glutInit(&argc, argv);
   glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH );
 
-  int shift = (argc < 4 ? 0 : atoi(argv[3]) * 450);
+  // Options after the model name.  A number in the third position
+  // (after the options are removed) shifts the window.
+
+  char *gpuLogFile = NULL;
+  bool cpuCulling = false;
+  int numArgs = 2;
+
+  modelFiles.add( argv[1] );
+
+  scheduler = new FrameScheduler();
+
+  for (int i=2; i<argc; i++)
+    if (strcmp( argv[i], "-fps" ) == 0 && i+1 < argc)
+      scheduler->setMode( FrameScheduler::TARGET_FPS, atof( argv[++i] ) );
+    else if (strcmp( argv[i], "-vsync" ) == 0)
+      scheduler->setMode( FrameScheduler::VSYNC );
+    else if (strcmp( argv[i], "-uncapped" ) == 0)
+      scheduler->setMode( FrameScheduler::UNCAPPED );
+    else if (strcmp( argv[i], "-gpulog" ) == 0 && i+1 < argc)
+      gpuLogFile = argv[++i];
+    else if (strcmp( argv[i], "-model" ) == 0 && i+1 < argc)
+      modelFiles.add( argv[++i] );
+    else if (strcmp( argv[i], "-instances" ) == 0 && i+1 < argc)
+      numInstances = atoi( argv[++i] );
+    else if (strcmp( argv[i], "-cpucull" ) == 0)
+      cpuCulling = true;
+    else if (strcmp( argv[i], "-compress" ) == 0)
+      wfModel::compressTextures = true;
+    else if (strcmp( argv[i], "-trace" ) == 0 && i+1 < argc) {
+      traceFile = argv[++i];
+      Profiler::start();	// from the start, to include loading
+    } else if (argv[i][0] == '-') {
+      cerr << "Unknown option '" << argv[i] << "'" << endl;
+      exit(1);
+    } else
+      argv[numArgs++] = argv[i];
+
+  int shift = (numArgs < 4 ? 0 : atoi(argv[3]) * 450);
 
   glutInitWindowSize( windowWidth, windowHeight );
   glutInitWindowPosition( 1700 + 50 + shift, 50 );
@@ -212,28 +544,38 @@ int main( int argc, char **argv )
     return 1;
   }
 
+  if (wfModel::compressTextures && !(GLEW_EXT_texture_compression_s3tc && GLEW_ARB_texture_storage)) {
+    cerr << "S3TC textures aren't supported, so textures won't be compressed" << endl;
+    wfModel::compressTextures = false;
+  }
+
   glutDisplayFunc( display );
   glutReshapeFunc( reshape );
   glutIdleFunc( idle );
   glutKeyboardFunc( keyPress );
   glutSpecialFunc( specialKeyPress );
 
-  // Set up world objects
+  // Start loading the first model, decoding textures on the thread
+  // pool.  display() shows it once it is loaded.
 
-  obj = new wfModel( argv[1] );
+  threadPool = new ThreadPool();
+  wfModel::texturePool = threadPool;
 
-  isTorso = (strlen(argv[1]) >= 9 && strcmp( &argv[1][strlen(argv[1])-9] , "torso.obj" ) == 0);
+  modelLoader = new ModelLoader();
+  modelLoader->load( modelFiles[0] );
 
-  // Point camera to the model
+  // Set up renderer
 
-  const float initEyeDistance = 5.0;
+  renderer = new Renderer( windowWidth, windowHeight );
+  frameCache = new FrameCache();
 
-  eyePosition = (initEyeDistance * obj->radius) * vec3(0,0,1);
-  fovy = 2 * atan2( 1, initEyeDistance );
+  if (gpuLogFile != NULL)
+    renderer->logPassStats( gpuLogFile );
 
-  // Set up renderer
+  if (cpuCulling)
+    renderer->gpuCulling = false;
 
-  renderer = new Renderer( windowWidth, windowHeight );
+  cpuRenderer = new CPURenderer( windowWidth, windowHeight, threadPool );
 
   // Go
 
@@ -4,7 +4,25 @@
 #define SHADER_H
 
 
+#include "linalg.h"
+#include "wavefront.h"
+
+
 extern GLuint windowWidth, windowHeight;
 extern float factor;
 
+// Viewing transforms of a model rotated by 'theta' about its centre
+
+bool isTorsoModel( const char *filename );
+
+void modelTransforms( wfModel *obj, float theta, bool isTorso,
+		      vec3 eyePosition, float fovy, float aspect,
+		      mat4 &M, mat4 &MV, mat4 &MVP, float sceneRadius = 0 );
+
+// Transforms for n copies of a model on a square grid in the OCS
+// x-y plane.  Returns the
+// radius of the whole grid.
+
+float instanceGrid( wfModel *obj, int n, mat4 *transforms );
+
 #endif
@@ -0,0 +1,85 @@
+/* syncQueue.h
+ *
+ * A bounded queue that can be shared between threads.
+ *
+ *   CONSTRUCTORS
+ *
+ *     syncQueue( n )      Create an empty queue that holds at most n elements
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     push( x )           Add x to the back, waiting while the queue is full.
+ *                         Returns false if the queue was closed.
+ *     pop( x )            Remove the front into x, waiting while the queue is
+ *                         empty.  Returns false once the queue is closed and
+ *                         empty.
+ *     tryPop( x )         Like pop(), but returns false immediately if empty
+ *     close()             Wake all waiting threads; no more pushes succeed
+ */
+
+
+#ifndef SYNCQUEUE_H
+#define SYNCQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+
+template<class T> class syncQueue {
+
+  std::deque<T>           elements;
+  unsigned int            capacity;
+  bool                    closed;
+  std::mutex              lock;
+  std::condition_variable notEmpty, notFull;
+
+public:
+
+  syncQueue( unsigned int n ) {
+    capacity = (n > 0 ? n : 1);
+    closed = false;
+  }
+
+  bool push( const T &x ) {
+    std::unique_lock<std::mutex> guard( lock );
+    while (!closed && elements.size() >= capacity)
+      notFull.wait( guard );
+    if (closed)
+      return false;
+    elements.push_back( x );
+    notEmpty.notify_one();
+    return true;
+  }
+
+  bool pop( T &x ) {
+    std::unique_lock<std::mutex> guard( lock );
+    while (!closed && elements.empty())
+      notEmpty.wait( guard );
+    if (elements.empty())
+      return false;
+    x = elements.front();
+    elements.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  bool tryPop( T &x ) {
+    std::lock_guard<std::mutex> guard( lock );
+    if (elements.empty())
+      return false;
+    x = elements.front();
+    elements.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> guard( lock );
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+};
+
+#endif
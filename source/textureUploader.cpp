@@ -0,0 +1,159 @@
+// Texture uploads through a ring of pixel buffer slots
+
+
+#include "textureUploader.h"
+#include "profiler.h"
+
+#include <string.h>
+
+
+TextureUploader::TextureUploader( long maxBytes )
+
+{
+  buffer = 0;
+  mapped = NULL;
+  nextSlot = 0;
+
+  for (int i=0; i<NUM_SLOTS; i++)
+    fences[i] = 0;
+
+  slotBytes = (maxBytes < SLOT_BYTES ? maxBytes : SLOT_BYTES);
+
+  if (!GLEW_ARB_buffer_storage || slotBytes <= 0)
+    return;
+
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  glGenBuffers( 1, &buffer );
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+  glBufferStorage( GL_PIXEL_UNPACK_BUFFER, NUM_SLOTS * slotBytes, NULL, flags );
+  mapped = (GLubyte *) glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, NUM_SLOTS * slotBytes, flags );
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+  if (mapped == NULL) {
+    cerr << "TextureUploader: Couldn't map a pixel buffer; uploading directly" << endl;
+    glDeleteBuffers( 1, &buffer );
+    buffer = 0;
+  }
+}
+
+
+// Uploads still in flight finish first: OpenGL deletes the buffer
+// once nothing uses it
+
+TextureUploader::~TextureUploader()
+
+{
+  for (int i=0; i<NUM_SLOTS; i++)
+    if (fences[i] != 0)
+      glDeleteSync( fences[i] );
+
+  if (buffer != 0) {
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+    glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    glDeleteBuffers( 1, &buffer );
+  }
+}
+
+
+// Next slot of the ring, once the GPU has finished reading from it
+
+GLubyte *TextureUploader::acquireSlot( int &slot )
+
+{
+  slot = nextSlot;
+  nextSlot = (nextSlot+1) % NUM_SLOTS;
+
+  if (fences[slot] != 0) {
+
+    PROFILE_ZONE( "TextureUploader wait" );
+
+    while (glClientWaitSync( fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) == GL_TIMEOUT_EXPIRED)
+      ;
+
+    glDeleteSync( fences[slot] );
+    fences[slot] = 0;
+  }
+
+  return mapped + slot * slotBytes;
+}
+
+
+void TextureUploader::storeLayer( int level, int layer, int width, int height, GLenum format, const GLubyte *pixels )
+
+{
+  PROFILE_ZONE( "TextureUploader::storeLayer" );
+
+  long rowBytes = (long) width * (format == GL_RGBA ? 4 : 3);
+
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+  if (buffer == 0 || rowBytes > slotBytes) {
+    glTexSubImage3D( GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, pixels );
+    return;
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+
+  int bandRows = slotBytes / rowBytes;
+
+  for (int y=0; y<height; y += bandRows) {
+
+    int rows = (height-y < bandRows ? height-y : bandRows);
+
+    int slot;
+    GLubyte *dest = acquireSlot( slot );
+
+    memcpy( dest, pixels + y * rowBytes, rows * rowBytes );
+
+    glTexSubImage3D( GL_TEXTURE_2D_ARRAY, level, 0, y, layer, width, rows, 1, format, GL_UNSIGNED_BYTE,
+		     (const GLvoid *) (slot * slotBytes) );
+
+    fences[slot] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
+
+
+// A band of block rows covers 4 rows of texels, except perhaps the
+// last, which ends at the bottom of the image
+
+void TextureUploader::storeCompressedLayer( int level, int layer, int width, int height, GLenum format,
+					    const GLubyte *blocks, long bytes )
+
+{
+  PROFILE_ZONE( "TextureUploader::storeCompressedLayer" );
+
+  int  blockRows = (height+3) / 4;
+  long rowBytes = bytes / blockRows;
+
+  if (buffer == 0 || rowBytes > slotBytes) {
+    glCompressedTexSubImage3D( GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, format, bytes, blocks );
+    return;
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+
+  int bandRows = slotBytes / rowBytes;
+
+  for (int by=0; by<blockRows; by += bandRows) {
+
+    int rows = (blockRows-by < bandRows ? blockRows-by : bandRows);
+    int y = 4*by;
+    int h = (4*rows < height-y ? 4*rows : height-y);
+
+    int slot;
+    GLubyte *dest = acquireSlot( slot );
+
+    memcpy( dest, blocks + by * rowBytes, rows * rowBytes );
+
+    glCompressedTexSubImage3D( GL_TEXTURE_2D_ARRAY, level, 0, y, layer, width, h, 1, format,
+			       rows * rowBytes, (const GLvoid *) (slot * slotBytes) );
+
+    fences[slot] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
@@ -0,0 +1,59 @@
+/* textureUploader.h
+ *
+ * Streams texture pixels to OpenGL through a ring of slots in one
+ * persistently mapped pixel buffer.  Pixels are copied straight from
+ * the caller's image into a slot, and glTexSubImage3D() reads them from
+ * there, so the driver returns at once instead of copying them itself.
+ * A fence after each upload marks when its slot can be written again;
+ * the ring only waits if the GPU is a whole ring behind.
+ *
+ * An image bigger than a slot goes in bands of rows (of blocks, for a
+ * compressed image).  Without
+ * ARB_buffer_storage (OpenGL 4.4) images are uploaded directly from the
+ * caller's memory.
+ *
+ *   CONSTRUCTORS
+ *
+ *     TextureUploader( maxBytes )   Slots big enough for maxBytes, up
+ *                                   to SLOT_BYTES
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     storeLayer( level, layer, width, height, format, pixels )
+ *                                   Store a GL_UNSIGNED_BYTE image in a
+ *                                   layer of a mipmap level of the bound
+ *                                   GL_TEXTURE_2D_ARRAY
+ *     storeCompressedLayer( level, layer, width, height, format, blocks, bytes )
+ *                                   The same for an image of 4x4 blocks
+ */
+
+
+#ifndef TEXTUREUPLOADER_H
+#define TEXTUREUPLOADER_H
+
+#include "headers.h"
+
+
+class TextureUploader {
+
+  enum { NUM_SLOTS = 4, SLOT_BYTES = 16 * 1024 * 1024 };
+
+  GLuint   buffer;		// 0 = upload directly
+  GLubyte *mapped;		// the whole buffer, NUM_SLOTS slots
+  long     slotBytes;
+  GLsync   fences[NUM_SLOTS];	// last upload from each slot (0 = none)
+  int      nextSlot;
+
+  GLubyte *acquireSlot( int &slot );
+
+ public:
+
+  TextureUploader( long maxBytes );
+  ~TextureUploader();
+
+  void storeLayer( int level, int layer, int width, int height, GLenum format, const GLubyte *pixels );
+  void storeCompressedLayer( int level, int layer, int width, int height, GLenum format,
+			     const GLubyte *blocks, long bytes );
+};
+
+#endif
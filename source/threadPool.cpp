@@ -0,0 +1,151 @@
+// Thread pool
+
+
+#include "threadPool.h"
+
+
+ThreadPool::ThreadPool( int n )
+
+{
+  if (n <= 0)
+    n = std::thread::hardware_concurrency();
+  if (n <= 0)
+    n = 1;
+
+  // The thread that calls parallelFor() does its share, so start one
+  // fewer
+
+  numThreads = n-1;
+  stopping = false;
+
+  threads = new std::thread*[ numThreads ];
+  for (int i=0; i<numThreads; i++)
+    threads[i] = new std::thread( &ThreadPool::workerMain, this );
+}
+
+
+ThreadPool::~ThreadPool()
+
+{
+  {
+    std::lock_guard<std::mutex> guard( lock );
+    stopping = true;
+    workAvailable.notify_all();
+  }
+
+  for (int i=0; i<numThreads; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  delete [] threads;
+}
+
+
+// Run the next iteration of a loop.  Returns false if all of its
+// iterations have been handed out.
+
+bool ThreadPool::runIteration( Loop *loop )
+
+{
+  int i = loop->next++;
+
+  if (i >= loop->count)
+    return false;
+
+  (*loop->body)( i );
+
+  if (++loop->finished == loop->count) {
+    std::lock_guard<std::mutex> guard( lock );
+    loopFinished.notify_all();
+  }
+
+  return true;
+}
+
+
+void ThreadPool::workerMain()
+
+{
+  while (true) {
+
+    Loop *loop;
+
+    {
+      std::unique_lock<std::mutex> guard( lock );
+
+      while (!stopping && loops.empty())
+	workAvailable.wait( guard );
+
+      if (stopping)
+	return;
+
+      loop = loops.front();
+
+      // Take a loop off the list once all of its iterations are
+      // handed out.  Its caller still owns it and waits for the
+      // running iterations to finish.
+
+      if (loop->next >= loop->count) {
+	loops.pop_front();
+	continue;
+      }
+
+      loop->users++;
+    }
+
+    while (runIteration( loop ))
+      ;
+
+    std::lock_guard<std::mutex> guard( lock );
+    loop->users--;
+    loopFinished.notify_all();
+  }
+}
+
+
+void ThreadPool::parallelFor( int count, const std::function<void(int)> &body )
+
+{
+  if (count <= 0)
+    return;
+
+  if (count == 1 || numThreads == 0) {
+    for (int i=0; i<count; i++)
+      body( i );
+    return;
+  }
+
+  Loop loop;
+
+  loop.body = &body;
+  loop.count = count;
+  loop.next = 0;
+  loop.finished = 0;
+  loop.users = 0;
+
+  {
+    std::lock_guard<std::mutex> guard( lock );
+    loops.push_back( &loop );
+    workAvailable.notify_all();
+  }
+
+  // Help out until everything is handed out
+
+  while (runIteration( &loop ))
+    ;
+
+  // Wait for the other threads' iterations, and until no worker still
+  // refers to this loop
+
+  std::unique_lock<std::mutex> guard( lock );
+
+  while (loop.finished < count || loop.users > 0)
+    loopFinished.wait( guard );
+
+  for (std::deque<Loop*>::iterator i=loops.begin(); i!=loops.end(); i++)
+    if (*i == &loop) {
+      loops.erase( i );
+      break;
+    }
+}
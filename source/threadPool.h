@@ -0,0 +1,64 @@
+/* threadPool.h
+ *
+ * A fixed set of worker threads that run the iterations of parallel
+ * loops.
+ *
+ *   CONSTRUCTORS
+ *
+ *     ThreadPool( n )            Start n threads (0 = one per core)
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     parallelFor( n, f )        Call f(0), ..., f(n-1), spread across the
+ *                                threads, and return when all have finished.
+ *                                The calling thread runs iterations too.
+ *                                Several threads may call this at once.
+ *     size()                     Number of threads, including the caller
+ */
+
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+
+class ThreadPool {
+
+  class Loop {
+  public:
+    const std::function<void(int)> *body;
+    int                             count;
+    std::atomic<int>                next;	// next iteration to hand out
+    std::atomic<int>                finished;	// iterations completed
+    int                             users;	// workers holding this loop (under lock)
+  };
+
+  int                     numThreads;
+  std::thread           **threads;
+  std::deque<Loop*>       loops;	// loops with iterations left to hand out
+  std::mutex              lock;
+  std::condition_variable workAvailable, loopFinished;
+  bool                    stopping;
+
+  void workerMain();
+  bool runIteration( Loop *loop );
+
+ public:
+
+  ThreadPool( int n = 0 );
+  ~ThreadPool();
+
+  void parallelFor( int count, const std::function<void(int)> &body );
+
+  int size() {
+    return numThreads + 1;
+  }
+};
+
+#endif
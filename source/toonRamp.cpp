@@ -0,0 +1,68 @@
+// Cel shading lookup table
+
+
+#include "toonRamp.h"
+
+#include <math.h>
+
+
+// The highest level i/numQuanta that n is above, or 0
+
+float ToonRamp::band( float n )
+
+{
+  for (int i=numQuanta; i>=1; i--) {
+    float level = i / (float) numQuanta;
+    if (n > level)
+      return level;
+  }
+
+  return 0;
+}
+
+
+float ToonRamp::diffuse( float n )
+
+{
+  return n > 0 ? diffuseWeight * n : 0;
+}
+
+
+float ToonRamp::specular( float s )
+
+{
+  if (s <= 0)
+    return 0;
+
+  if (specularThreshold > 0)
+    return s > specularThreshold ? specularWeight : 0;
+
+  return specularWeight * powf( s, specularExponent );
+}
+
+
+// Each texel holds the functions at its centre, which is where
+// nearest-texel lookups of n land
+
+void ToonRamp::makeBands( float *rgb )
+
+{
+  for (int i=0; i<SIZE_N; i++) {
+    float n = (i + 0.5) / SIZE_N;
+    rgb[3*i+0] = band( n );
+    rgb[3*i+1] = lit( n );
+    rgb[3*i+2] = diffuse( n );
+  }
+}
+
+
+// The first and last texels hold s = 0 and s = 1 exactly.  Pass 3
+// looks up s at the texel centres scaled to match, so that linear
+// filtering reaches the full highlight at s = 1.
+
+void ToonRamp::makeSpecular( float *s )
+
+{
+  for (int j=0; j<SIZE_S; j++)
+    s[j] = specular( j / (float) (SIZE_S-1) );
+}
@@ -0,0 +1,92 @@
+/* toonRamp.h
+ *
+ * Cel shading as lookup tables.
+ *
+ * For n = N.L the band table gives
+ *
+ *   R = band( n )       quantized level, which multiplies the colour
+ *   G = lit( n )        0 where the pixel is drawn black, 1 otherwise
+ *   B = diffuse( n )    smooth diffuse level, which multiplies the depth
+ *
+ * and for s = R.V the specular table gives specular( s ), the
+ * highlight.  Pass 3 reads each from a one-texel-high texture, so the
+ * bands can change without recompiling the shader.  The band texture
+ * is sampled at the nearest texel, to keep the band edges hard; the
+ * specular one is interpolated, as (R.V)^200 changes too fast near
+ * s = 1 for the nearest of a few hundred texels.  The CPU renderer
+ * evaluates the same functions directly.
+ *
+ * The defaults are the old pass3.frag: 3 quanta, black at or below
+ * N.L = 0.2, and a highlight of 0.4 (R.V)^200.
+ *
+ *   PUBLIC FUNCTIONS
+ *
+ *     band( n ), lit( n ), diffuse( n ), specular( s )
+ *     makeBands( rgb )           Fill SIZE_N RGB floats, at the texel
+ *                                centres of n = 0 to 1
+ *     makeSpecular( s )          Fill SIZE_S floats, from s = 0 in the
+ *                                first texel to s = 1 in the last
+ *     nextNumQuanta()            Cycle through 1 to MAX_QUANTA bands
+ *     toggleSpecularBand()       Switch between a smooth highlight and
+ *                                a hard-edged one
+ */
+
+
+#ifndef TOONRAMP_H
+#define TOONRAMP_H
+
+
+class ToonRamp {
+
+ public:
+
+  enum { SIZE_N = 1024,		// texels along N.L, so band edges are within 0.001
+	 SIZE_S = 4096,		// texels along R.V, interpolated
+	 MAX_QUANTA = 6 };
+
+  int   numQuanta;		// diffuse bands
+  float minDiffuse;		// N.L at or below which the pixel is black
+  float diffuseWeight;		// of the smooth diffuse term (0 = none)
+  float specularWeight;		// of the highlight (0 = none)
+  float specularExponent;
+  float specularThreshold;	// if > 0, the highlight is specularWeight where R.V > this
+
+  ToonRamp() {
+    numQuanta = 3;
+    minDiffuse = 0.2;
+    diffuseWeight = 1;
+    specularWeight = 0.4;
+    specularExponent = 200;
+    specularThreshold = 0;
+  }
+
+  bool operator == ( const ToonRamp &r ) const {
+    return numQuanta == r.numQuanta && minDiffuse == r.minDiffuse && diffuseWeight == r.diffuseWeight &&
+      specularWeight == r.specularWeight && specularExponent == r.specularExponent &&
+      specularThreshold == r.specularThreshold;
+  }
+
+  bool operator != ( const ToonRamp &r ) const {
+    return !(*this == r);
+  }
+
+  float band( float n );
+  float lit( float n ) {
+    return n > minDiffuse ? 1 : 0;
+  }
+  float diffuse( float n );
+  float specular( float s );
+
+  void makeBands( float *rgb );
+  void makeSpecular( float *s );
+
+  void nextNumQuanta() {
+    numQuanta = numQuanta % MAX_QUANTA + 1;
+  }
+
+  void toggleSpecularBand() {
+    specularThreshold = (specularThreshold > 0 ? 0 : 0.95);
+  }
+};
+
+#endif
@@ -4,10 +4,17 @@
 
 #include "headers.h"
 #include "gpuProgram.h"
+#include "profiler.h"
+#include "mipmap.h"
+
+#include <unordered_map>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <ctype.h>
 
 #ifdef HAVE_PNG
 #include <png.h>
@@ -18,6 +25,9 @@
 
 bool          wfModel::newGroupWithNewMaterial = false;
 bool          wfModel::verticesAreCW = false;
+std::atomic<unsigned int> wfModel::nextInstancesID( 0 );
+ThreadPool   *wfModel::texturePool = NULL;
+bool          wfModel::compressTextures = false;
 
 unsigned char wfMaterial::defaultTexmap[] = { 255, 255, 255, 255, 255, 255,
 	255, 255, 255, 255, 255, 255 };
@@ -31,6 +41,8 @@ unsigned char wfMaterial::defaultTexmap[] = { 255, 255, 255, 255, 255, 255,
 void wfModel::read( char *filename )
 
 {
+  PROFILE_ZONE( "wfModel::read" );
+
   FILE* file;
   char  buf[1000];
   float x, y, z;
@@ -346,12 +358,45 @@ void wfModel::read( char *filename )
 
   centre = 0.5 * (min + max);
   radius = 0.5 * (max - min).length();
+
+  // Find each group's bounding box and a sphere around it
+
+  for (int g=0; g<groups.size(); g++) {
+
+    wfGroup *group = groups[g];
+
+    group->min = vec3(MAXFLOAT,MAXFLOAT,MAXFLOAT);
+    group->max = vec3(-MAXFLOAT,-MAXFLOAT,-MAXFLOAT);
+
+    for (int i=0; i<group->triangles.size(); i++)
+      for (int k=0; k<3; k++) {
+	vec3 &v = vertices[ group->triangles[i]->vindices[k] ];
+
+	if (v.x < group->min.x)
+	  group->min.x = v.x;
+	if (v.y < group->min.y)
+	  group->min.y = v.y;
+	if (v.z < group->min.z)
+	  group->min.z = v.z;
+	if (v.x > group->max.x)
+	  group->max.x = v.x;
+	if (v.y > group->max.y)
+	  group->max.y = v.y;
+	if (v.z > group->max.z)
+	  group->max.z = v.z;
+      }
+
+    group->centre = 0.5 * (group->min + group->max);
+    group->radius = 0.5 * (group->max - group->min).length();
+  }
 }
 
 
 void wfModel::readMaterialLibrary( char *name )
 
 {
+  PROFILE_ZONE( "wfModel::readMaterialLibrary" );
+
   FILE* file;
   char  buf[1000];
   wfMaterial *currentMaterial;
@@ -469,12 +514,12 @@ void wfModel::readMaterialLibrary( char *name )
 	strcpy(filename, dir);
 	strcat(filename, buf);
 
-	// load the texture
+	// load the texture later, with the others
 
-	currentMaterial->loadTexmap( filename );
+	delete [] currentMaterial->texmapFilename;
+	currentMaterial->texmapFilename = filename;
 
 	delete [] dir;
-	delete [] filename;
       }
 
       break;
@@ -488,6 +533,117 @@ void wfModel::readMaterialLibrary( char *name )
 
   delete [] dir;
   delete [] filename;
+
+  loadTextures();
+}
+
+
+/* Decode the textures that the materials name, and make their
+ * mipmaps.  The textures are decoded at once, each on a thread of
+ * texturePool (if there is one), and then each level is made with all
+ * the threads.
+ *
+ * With compressTextures, each texture is read from its compressed
+ * cache if that is up to date.  Otherwise it is decoded, compressed and
+ * cached, and the uncompressed copy is dropped.
+ */
+
+
+void wfModel::loadTextures()
+
+{
+  PROFILE_ZONE( "wfModel::loadTextures" );
+
+  seq<wfMaterial*> pending;
+
+  for (int i=0; i<materials.size(); i++)
+    if (materials[i]->texmapFilename != NULL)
+      pending.add( materials[i] );
+
+  auto decode = [&]( int i ) {
+    wfMaterial *m = pending[i];
+    if (!compressTextures || !m->readCompressed())
+      m->loadTexmap( m->texmapFilename );
+  };
+
+  if (texturePool != NULL)
+    texturePool->parallelFor( pending.size(), decode );
+  else
+    for (int i=0; i<pending.size(); i++)
+      decode( i );
+
+  for (int i=0; i<pending.size(); i++) {
+
+    wfMaterial *m = pending[i];
+
+    if (m->compressed == NULL) {
+
+      m->buildMipmaps( texturePool );
+
+      if (compressTextures) {
+	m->compressed = new CompressedTexture();
+	m->compressed->compress( m->levels, m->width, m->height, m->numLevels, m->hasAlpha, texturePool );
+	m->compressed->write( m->texmapFilename );
+	m->freeMipmaps();
+	m->freeTexmap();
+      }
+    }
+
+    delete [] m->texmapFilename;
+    m->texmapFilename = NULL;
+  }
+}
+
+
+/* Free everything.  The OpenGL objects are deleted only if they were
+ * created, so a model that was read but never set up (e.g. by a
+ * renderer without OpenGL) can be deleted without a context.
+ */
+
+
+wfModel::~wfModel()
+
+{
+  if (VAOinitialized) {
+    glDeleteVertexArrays( 1, &VAO );
+    glDeleteBuffers( 1, &VBO );
+    glDeleteBuffers( 1, &IBO );
+    glDeleteBuffers( 1, &drawBuffer );
+    glDeleteBuffers( 1, &instanceBuffer );
+  }
+
+  delete [] vertexData;
+  delete [] indexData;
+  delete [] drawCommands;
+  delete [] drawMaterials;
+  delete [] drawBounds;
+  delete [] instanceTransforms;
+  delete [] instanceScales;
+  delete [] visibleTransforms;
+
+  for (int i=0; i<groups.size(); i++) {
+    wfGroup *group = groups[i];
+
+    for (int j=0; j<group->triangles.size(); j++)
+      delete group->triangles[j];
+
+    delete group;
+  }
+
+  for (int i=0; i<materials.size(); i++)
+    delete materials[i];
+
+  for (int i=0; i<textureArrays.size(); i++) {
+    if (texturesInitialized)
+      glDeleteTextures( 1, &textureArrays[i]->textureID );
+    delete textureArrays[i];
+  }
+
+  if (texturesInitialized)
+    GLState::forget();
+
+  free( pathname );
+  free( mtllibname );
 }
 
 
@@ -498,6 +654,11 @@ void wfModel::readMaterialLibrary( char *name )
 void wfMaterial::loadTexmap( char *filename )
 
 {
+  PROFILE_ZONE( "wfMaterial::loadTexmap" );
+
+  freeMipmaps();
+  freeTexmap();
+
   char *p = strrchr( filename, '.' );
   if (p == NULL || strcmp( p, ".ppm" ) == 0)
     texmap = readP6( filename );
@@ -506,6 +667,79 @@ void wfMaterial::loadTexmap( char *filename )
 }
 
 
+/* Make the mipmap levels of texmap, levels[1] onwards
+ */
+
+
+void wfMaterial::buildMipmaps( ThreadPool *pool )
+
+{
+  PROFILE_ZONE( "wfMaterial::buildMipmaps" );
+
+  freeMipmaps();
+
+  int channels = (hasAlpha ? 4 : 3);
+
+  numLevels = numMipLevels( width, height );
+  levels = new GLubyte*[ numLevels ];
+  levels[0] = texmap;
+
+  for (int l=1; l<numLevels; l++) {
+    levels[l] = new GLubyte[ mipLevelSize( width, l ) * mipLevelSize( height, l ) * channels ];
+    halveImage( levels[l-1], mipLevelSize( width, l-1 ), mipLevelSize( height, l-1 ), channels, levels[l], pool );
+  }
+}
+
+
+/* Use the compressed cache of the texture, if it is up to date
+ */
+
+
+bool wfMaterial::readCompressed()
+
+{
+  CompressedTexture *c = new CompressedTexture();
+
+  if (!c->read( texmapFilename )) {
+    delete c;
+    return false;
+  }
+
+  compressed = c;
+  width = c->width;
+  height = c->height;
+  hasAlpha = (c->format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT);
+
+  return true;
+}
+
+
+void wfMaterial::freeTexmap()
+
+{
+  if (mapping != NULL) {
+    munmap( mapping, mappingBytes );
+    mapping = NULL;
+  } else
+    delete [] texmap;
+
+  texmap = NULL;
+}
+
+
+void wfMaterial::freeMipmaps()
+
+{
+  for (int l=1; l<numLevels; l++)
+    delete [] levels[l];
+
+  delete [] levels;
+
+  levels = NULL;
+  numLevels = 0;
+}
+
+
 wfMaterial* wfModel::findMaterial( char *name )
 
 {
@@ -545,16 +779,50 @@ wfGroup* wfModel::findGroup( char *name )
 class VertexSignature {
 public:
   unsigned int sig[3];
-  bool operator == (const VertexSignature p) {
+  bool operator == (const VertexSignature p) const {
     return sig[0] == p.sig[0] && sig[1] == p.sig[1] && sig[2] == p.sig[2];
   }
 };
 
 
+class VertexSignatureHash {
+public:
+  size_t operator () (const VertexSignature &vs) const {
+    return (vs.sig[0] * 73856093u) ^ (vs.sig[1] * 19349663u) ^ (vs.sig[2] * 83492791u);
+  }
+};
 
-void wfModel::setupVAO()
+
+
+/* Pack all groups into one vertex buffer and one index buffer, with
+ * one draw command for all the groups of each material.  This needs
+ * no OpenGL context, so it can be done on a loader thread.
+ *
+ * The draws are sorted so that those that set the same state are
+ * next to each other and drawRuns() can send them in one multi-draw:
+ * untextured draws first, then textured, then blended, and by
+ * texture array and then material within each.  (There is no program
+ * in the key, as every draw of a pass uses the pass's program.)
+ */
+
+
+static int stateOrder( wfMaterial *m )
+
+{
+  if (m == NULL || !m->hasTexture())
+    return 0;
+  return m->hasAlpha ? 2 : 1;
+}
+
+
+void wfModel::buildBuffers()
 
 {
+  PROFILE_ZONE( "wfModel::buildBuffers" );
+
+  if (buffersBuilt)
+    return;
+
   // Note that positions, normals, and texture coordinates can all be
   // indexed differently in a Wavefront file.  But OpenGL permits only
   // one index per vertex, and the OpenGL vertex encapsulates all
@@ -564,31 +832,109 @@ void wfModel::setupVAO()
   // vertex stores position, normal, and texture coordinates and the
   // face indices index into this new array.
 
-  unsigned int vertexSize = 3;
+  vertexSize = 3;
 
   if (hasVertexNormals)
     vertexSize += 3;
 
   if (hasVertexTexCoords)
-    vertexSize += 2;
+    vertexSize += 3;
+
+  assignLayers();
+
+  // Sort the non-empty groups by state and material, keeping file
+  // order among groups of the same material
 
-  // Process each group separately
+  int *order = new int[ groups.size() ];
+  int *groupMaterial = new int[ groups.size() ];
+  int numGroups = 0;
+  int numTriangles = 0;
 
   for (int i=0; i<groups.size(); i++) {
+    groupMaterial[i] = materials.findIndex( groups[i]->material );
+    if (groups[i]->triangles.size() > 0) {
+      numTriangles += groups[i]->triangles.size();
+      order[ numGroups++ ] = i;
+    }
+  }
+
+  std::stable_sort( order, order+numGroups, [&]( int a, int b ) {
+      wfMaterial *ma = groups[a]->material;
+      wfMaterial *mb = groups[b]->material;
+      int sa = stateOrder( ma );
+      int sb = stateOrder( mb );
+      if (sa != sb)
+	return sa < sb;
+      if (sa > 0 && ma->arrayIndex != mb->arrayIndex)
+	return ma->arrayIndex < mb->arrayIndex;
+      return groupMaterial[a] < groupMaterial[b];
+    } );
+
+  // One draw for each run of groups with the same material
+
+  numDraws = 0;
+
+  for (int j=0; j<numGroups; j++)
+    if (j == 0 || groupMaterial[order[j]] != groupMaterial[order[j-1]])
+      numDraws++;
+
+  vertexData = new GLfloat[ numTriangles * 3 * vertexSize ];
+  indexData = new GLuint[ numTriangles * 3 ];
+  drawCommands = new wfDrawCommand[ numDraws ];
+  drawMaterials = new int[ numDraws ];
+  drawBounds = new wfBounds[ numDraws ];
+
+  numVertices = 0;
+  numIndices = 0;
+
+  // Each draw's vertices are shared only within the draw, so that it
+  // covers a contiguous range of both buffers
+
+  std::unordered_map<VertexSignature,GLuint,VertexSignatureHash> vertexIndex;
+
+  int d = 0;
+
+  for (int first=0; first<numGroups; ) {
+
+    int material = groupMaterial[ order[first] ];
+
+    int last = first;
+    while (last < numGroups && groupMaterial[ order[last] ] == material)
+      last++;
+
+    wfDrawCommand &cmd = drawCommands[d];
+    wfBounds &bounds = drawBounds[d];
 
-    wfGroup *thisGroup = groups[i];
+    cmd.count = 0;
+    cmd.instanceCount = 0;
+    cmd.firstIndex = numIndices;
+    cmd.baseVertex = numVertices;
+    cmd.baseInstance = 0;
 
-    int numTriangles = thisGroup->triangles.size();
+    drawMaterials[d] = material;
 
-    if (numTriangles > 0) {
+    float layer = (material >= 0 ? materials[material]->layer : 0);
 
-      GLfloat *vertexBuffer =  new GLfloat[ numTriangles * 3 * vertexSize ];
-      GLuint *faceIndexBuffer= new GLuint[ numTriangles * 3 ];
+    bounds.min = vec3(MAXFLOAT,MAXFLOAT,MAXFLOAT);
+    bounds.max = vec3(-MAXFLOAT,-MAXFLOAT,-MAXFLOAT);
 
-      unsigned int nVerts = 0;
-      nFaces = 0;
+    vertexIndex.clear();
 
-      VertexSignature *vertSig = new VertexSignature[ numTriangles * 3 ];
+    GLfloat *drawVertices = &vertexData[ numVertices * vertexSize ];
+    unsigned int nVerts = 0;
+
+    for (int g=first; g<last; g++) {
+
+      wfGroup *thisGroup = groups[ order[g] ];
+
+      cmd.count += 3 * thisGroup->triangles.size();
+
+      for (int c=0; c<3; c++) {
+	if (thisGroup->min[c] < bounds.min[c])
+	  bounds.min[c] = thisGroup->min[c];
+	if (thisGroup->max[c] > bounds.max[c])
+	  bounds.max[c] = thisGroup->max[c];
+      }
 
       for (int j=0; j<thisGroup->triangles.size(); j++) {
 
@@ -596,7 +942,7 @@ void wfModel::setupVAO()
 
 	for (int k=0; k<3; k++) {
 
-	  // Find an already-stored vertex with this signature (brute force)
+	  // Find an already-stored vertex with this signature
 
 	  VertexSignature vs;
 
@@ -604,119 +950,419 @@ void wfModel::setupVAO()
 	  vs.sig[1] = tri->nindices[k];
 	  vs.sig[2] = tri->tindices[k];
 
-	  unsigned int l;
-	  for (l=0; l<nVerts; l++)
-	    if (vs == vertSig[l])
-	      break;
+	  std::pair<std::unordered_map<VertexSignature,GLuint,VertexSignatureHash>::iterator,bool> found
+	    = vertexIndex.insert( std::make_pair( vs, nVerts ) );
 
-	  if (l == nVerts) {	// none found ... create a new vertex
-	    * (vec3*) &vertexBuffer[nVerts*vertexSize] = vertices[ tri->vindices[k] ];
+	  if (found.second) {	// none found ... create a new vertex
+	    * (vec3*) &drawVertices[nVerts*vertexSize] = vertices[ tri->vindices[k] ];
 	    if (hasVertexNormals)
-	      * (vec3*) &vertexBuffer[nVerts*vertexSize+3] = normals[ tri->nindices[k] ];
-	    if (hasVertexTexCoords)
-	      if (hasVertexNormals)
-		* (vec2*) &vertexBuffer[nVerts*vertexSize+6] = * (vec2*) &texcoords[ tri->tindices[k] ];
-	      else
-		* (vec2*) &vertexBuffer[nVerts*vertexSize+3] = * (vec2*) &texcoords[ tri->tindices[k] ];
-
-	    vertSig[ nVerts ] = vs;
+	      * (vec3*) &drawVertices[nVerts*vertexSize+3] = normals[ tri->nindices[k] ];
+	    if (hasVertexTexCoords) {
+	      GLfloat *t = &drawVertices[nVerts*vertexSize + (hasVertexNormals ? 6 : 3)];
+	      * (vec2*) t = * (vec2*) &texcoords[ tri->tindices[k] ];
+	      t[1] = 1 - t[1];	// textures are stored top row first
+	      t[2] = layer;
+	    }
 
 	    nVerts++;
 	  }
 
-	  // Store this vertex index
+	  // Store this vertex index, relative to the draw's first vertex
 
-	  faceIndexBuffer[ nFaces * 3 + k ] = l;
+	  indexData[ numIndices++ ] = found.first->second;
 	}
+      }
+    }
 
-	nFaces++;
+    bounds.centre = 0.5 * (bounds.min + bounds.max);
+    bounds.radius = 0.5 * (bounds.max - bounds.min).length();
 
-      }
+    numVertices += nVerts;
+    first = last;
+    d++;
+  }
+
+  delete [] order;
+  delete [] groupMaterial;
+
+  buffersBuilt = true;
+}
+
+
+
+void wfModel::setupVAO()
+
+{
+  PROFILE_ZONE( "wfModel::setupVAO" );
+
+  buildBuffers();
+
+  if (numDraws > 0) {
 
-      //cout << "stored " << nVerts << " verts, " << nFaces << " faces" << endl;
+    // Set up the VAO
 
-      // Set up the VAO
+    glGenVertexArrays( 1, &VAO );
+    glBindVertexArray( VAO );
 
-      glGenVertexArrays( 1, &thisGroup->VAO );
-      glBindVertexArray( thisGroup->VAO );
+    // store vertices
 
-      GLuint bufferID;
+    glGenBuffers( 1, &VBO );
+    glBindBuffer( GL_ARRAY_BUFFER, VBO );
+    glBufferData( GL_ARRAY_BUFFER, numVertices * vertexSize * sizeof(GLfloat), vertexData, GL_STATIC_DRAW );
 
-      // store vertices
+    // store faces
 
-      glGenBuffers( 1, &bufferID );
-      glBindBuffer( GL_ARRAY_BUFFER, bufferID );
-      glBufferData( GL_ARRAY_BUFFER, nVerts * vertexSize * sizeof(GLfloat), vertexBuffer, GL_STATIC_DRAW );
+    glGenBuffers( 1, &IBO );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, IBO );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), indexData, GL_STATIC_DRAW );
 
-      // store faces
+    // draw commands are stored by each draw(), after culling
 
-      glGenBuffers( 1, &bufferID );
-      glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, bufferID );
-      glBufferData( GL_ELEMENT_ARRAY_BUFFER, nFaces * 3 * sizeof(GLuint), faceIndexBuffer, GL_STATIC_DRAW );
+    glGenBuffers( 1, &drawBuffer );
 
-      // define attributes
+    // define attributes
 
-      int attribIndex = 0;
-      unsigned long int accumulatedOffset = 0;
+    int attribIndex = 0;
+    unsigned long int accumulatedOffset = 0;
 
-      // position = attribute 0
+    // position = attribute 0
 
+    glEnableVertexAttribArray( attribIndex );
+    glVertexAttribPointer( attribIndex, 3, GL_FLOAT, GL_FALSE, vertexSize * sizeof(GLfloat), (const GLvoid*) accumulatedOffset );
+    attribIndex++;
+    accumulatedOffset += 3 * sizeof( float );
+
+    // normals = next attribute
+
+    if (hasVertexNormals) {
       glEnableVertexAttribArray( attribIndex );
       glVertexAttribPointer( attribIndex, 3, GL_FLOAT, GL_FALSE, vertexSize * sizeof(GLfloat), (const GLvoid*) accumulatedOffset );
       attribIndex++;
       accumulatedOffset += 3 * sizeof( float );
+    }
 
-      // normals = next attribute
-
-      if (hasVertexNormals) {
-	glEnableVertexAttribArray( attribIndex );
-	glVertexAttribPointer( attribIndex, 3, GL_FLOAT, GL_FALSE, vertexSize * sizeof(GLfloat), (const GLvoid*) accumulatedOffset );
-	attribIndex++;
-	accumulatedOffset += 3 * sizeof( float );
-      }
+    // texture coordinates and texture array layer = next attribute
 
-      // texture coordinates = next attribute
+    if (hasVertexTexCoords) {
+      glEnableVertexAttribArray( attribIndex );
+      glVertexAttribPointer( attribIndex, 3, GL_FLOAT, GL_FALSE, vertexSize * sizeof(GLfloat), (const GLvoid*) accumulatedOffset );
+      attribIndex++;
+      accumulatedOffset += 3 * sizeof( float );
+    }
 
-      if (hasVertexTexCoords) {
-	glEnableVertexAttribArray( attribIndex );
-	glVertexAttribPointer( attribIndex, 2, GL_FLOAT, GL_FALSE, vertexSize * sizeof(GLfloat), (const GLvoid*) accumulatedOffset );
-	attribIndex++;
-	accumulatedOffset += 2 * sizeof( float );
-      }
+    // instance transforms = attributes INSTANCE_ATTRIB to INSTANCE_ATTRIB+3,
+    // one row each, advancing once per instance
 
-      thisGroup->VAOinitialized = true;
+    glGenBuffers( 1, &instanceBuffer );
 
-      delete [] vertexBuffer;
-      delete [] faceIndexBuffer;
-      delete [] vertSig;
+    for (int r=0; r<4; r++) {
+      glEnableVertexAttribArray( INSTANCE_ATTRIB + r );
+      glVertexAttribDivisor( INSTANCE_ATTRIB + r, 1 );
     }
+
+    VAOinitialized = true;
+
+    glBindVertexArray( 0 );
   }
 
+  // The GPU has its own copy now
+
+  delete [] vertexData;
+  delete [] indexData;
+  vertexData = NULL;
+  indexData = NULL;
+
   initTextures();
 }
 
 
-void wfModel::draw( GPUProgram * gpuProg )
+void wfModel::buildMesh( wfMesh &mesh )
 
 {
-  for (int i=0; i<groups.size(); i++)
-    if (groups[i]->VAOinitialized) {
+  PROFILE_ZONE( "wfModel::buildMesh" );
 
-      // Set up material properties
+  delete [] mesh.positions;
+  delete [] mesh.indices;
+  delete [] mesh.normals;
 
-      groups[i]->material->setMaterial( true, true, gpuProg );
+  mesh.numPositions = vertices.size();
+  mesh.positions = new vec3[ mesh.numPositions ];
 
-      // Render
+  for (int i=0; i<vertices.size(); i++)
+    mesh.positions[i] = vertices[i];
 
-      glBindVertexArray( groups[i]->VAO );
-      glDrawElements( GL_TRIANGLES, nFaces * 3, GL_UNSIGNED_INT, 0 );
+  mesh.numTriangles = 0;
+  for (int g=0; g<groups.size(); g++)
+    mesh.numTriangles += groups[g]->triangles.size();
+
+  mesh.indices = new GLuint[ mesh.numTriangles * 3 ];
+  mesh.normals = new vec3[ mesh.numTriangles * 3 ];
+
+  int t = 0;
+
+  for (int g=0; g<groups.size(); g++)
+    for (int i=0; i<groups[g]->triangles.size(); i++) {
+
+      wfTriangle *tri = groups[g]->triangles[i];
+
+      for (int k=0; k<3; k++) {
+	mesh.indices[ 3*t+k ] = tri->vindices[k];
+	mesh.normals[ 3*t+k ] = (hasVertexNormals ? normals[ tri->nindices[k] ] : facetnorms[ tri->findex ]);
+      }
+
+      t++;
     }
 }
 
 
+/* Set the transforms of the copies of the model that draw() draws.
+ * Each transform is applied in the OCS, before the M passed to the
+ * shader.
+ */
+
+
+void wfModel::setInstances( int n, mat4 *transforms )
+
+{
+  delete [] instanceTransforms;
+  delete [] instanceScales;
+
+  numInstances = n;
+  instanceTransforms = new mat4[ numInstances ];
+  instanceScales = new float[ numInstances ];
+  instancesID = nextInstancesID++;
+
+  // A sphere of radius r is inside one of radius r*scale after the
+  // transform, where scale is the length of the longest transformed
+  // axis.  (That is exact for rotations and scales.)
+
+  for (int i=0; i<numInstances; i++) {
+
+    mat4 &T = instanceTransforms[i];
+
+    T = transforms[i];
+
+    instanceScales[i] = 0;
+    for (int c=0; c<3; c++) {
+      float s = sqrt( T[0][c]*T[0][c] + T[1][c]*T[1][c] + T[2][c]*T[2][c] );
+      if (s > instanceScales[i])
+	instanceScales[i] = s;
+    }
+  }
+}
+
+
+// Add a transform to those that the current draw sees
+
+void wfModel::addVisible( mat4 &T )
+
+{
+  if (numVisible == maxVisible) {
+    maxVisible = (maxVisible == 0 ? 64 : 2 * maxVisible);
+    mat4 *bigger = new mat4[ maxVisible ];
+    for (int i=0; i<numVisible; i++)
+      bigger[i] = visibleTransforms[i];
+    delete [] visibleTransforms;
+    visibleTransforms = bigger;
+  }
+
+  visibleTransforms[ numVisible++ ] = T;
+}
+
+
+// Set each draw's instanceCount and baseInstance to cover the copies
+// of its group that are in MVP's view.  Each instance is tested by its
+// transformed bounding sphere.  A single untransformed copy
+// (allInstances false) gets the tighter test of the group's box.
+
+void wfModel::cull( mat4 &MVP, bool allInstances )
+
+{
+  PROFILE_ZONE( "wfModel::cull" );
+
+  vec4 planes[6];
+  frustumPlanes( MVP, planes );
+
+  mat4 I = identity();
+
+  numVisible = 0;
+
+  for (int d=0; d<numDraws; d++) {
+
+    wfBounds &bounds = drawBounds[d];
+    wfDrawCommand &cmd = drawCommands[d];
+
+    cmd.baseInstance = numVisible;
+
+    if (!allInstances) {
+
+      if (!sphereOutsideFrustum( planes, bounds.centre, bounds.radius ) &&
+	  !boxOutsideFrustum( planes, bounds.min, bounds.max ))
+	addVisible( I );
+
+    } else
+
+      for (int i=0; i<numInstances; i++) {
+
+	mat4 &T = instanceTransforms[i];
+	vec4 c = T * vec4( bounds.centre.x, bounds.centre.y, bounds.centre.z, 1 );
+
+	if (!sphereOutsideFrustum( planes, vec3( c.x, c.y, c.z ), bounds.radius * instanceScales[i] ))
+	  addVisible( T );
+      }
+
+    cmd.instanceCount = numVisible - cmd.baseInstance;
+  }
+}
+
+
+// Point the (bound) VAO's instance attributes at transform 'first'
+// of a buffer of transforms
+
+void wfModel::pointToInstances( GLuint buffer, int first )
+
+{
+  glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+  for (int r=0; r<4; r++)
+    glVertexAttribPointer( INSTANCE_ATTRIB + r, 4, GL_FLOAT, GL_FALSE, sizeof(mat4),
+			   (const GLvoid *) (first * sizeof(mat4) + r * sizeof(vec4)) );
+}
+
+
+// Draw the groups that MVP can see.  Consecutive draws whose materials
+// set the same OpenGL state (texture and blending) go out in one
+// multi-draw; for a model without textures, or whose textures share
+// one texture array, that is the whole model.
+// The material uniforms are those of the first draw of each
+// multi-draw, which doesn't matter to pass 1, as it doesn't use them.
+// Culled draws stay in the multi-draw with no instances.
+//
+// All instances are drawn, unless allInstances is false, in which
+// case one copy is drawn with no instance transform.
+
+void wfModel::draw( GPUProgram * gpuProg, mat4 &MVP, bool allInstances )
+
+{
+  PROFILE_ZONE( "wfModel::draw" );
+
+  if (!VAOinitialized)
+    return;
+
+  cull( MVP, allInstances );
+
+  if (numVisible == 0)
+    return;
+
+  glBindVertexArray( VAO );
+
+  // Store this frame's transforms and draw commands, in new storage
+  // so as not to wait for the GPU to finish with the last frame's
+
+  glBindBuffer( GL_ARRAY_BUFFER, instanceBuffer );
+  glBufferData( GL_ARRAY_BUFFER, numVisible * sizeof(mat4), visibleTransforms, GL_STREAM_DRAW );
+
+  pointToInstances( instanceBuffer, 0 );
+
+  if (GLEW_ARB_multi_draw_indirect) {
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, drawBuffer );
+    glBufferData( GL_DRAW_INDIRECT_BUFFER, numDraws * sizeof(wfDrawCommand), drawCommands, GL_STREAM_DRAW );
+  }
+
+  drawRuns( gpuProg );
+
+  if (GLEW_ARB_multi_draw_indirect)
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+
+  glBindVertexArray( 0 );
+}
+
+
+// Draw with draw commands and instance transforms that are already
+// on the GPU (e.g. from GPUCuller), laid out as draw() lays them out.
+// This needs ARB_multi_draw_indirect.
+
+void wfModel::drawIndirect( GPUProgram * gpuProg, GLuint commands, GLuint transforms )
+
+{
+  PROFILE_ZONE( "wfModel::drawIndirect" );
+
+  if (!VAOinitialized)
+    return;
+
+  glBindVertexArray( VAO );
+
+  pointToInstances( transforms, 0 );
+  glBindBuffer( GL_DRAW_INDIRECT_BUFFER, commands );
+
+  drawRuns( gpuProg );
+
+  glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+  glBindVertexArray( 0 );
+}
+
+
+// Issue all draws, a run of draws with the same material state at a
+// time, from the bound VAO and draw command buffer
+
+void wfModel::drawRuns( GPUProgram * gpuProg )
+
+{
+  int first = 0;
+
+  while (first < numDraws) {
+
+    wfMaterial *material = materials[ drawMaterials[first] ];
+
+    int last = first+1;
+    while (last < numDraws && materials[ drawMaterials[last] ]->sameState( material ))
+      last++;
+
+    // Set up material properties
+
+    material->setMaterial( true, true, gpuProg );
+
+    // Render
+
+    multiDraw( first, last-first );
+
+    first = last;
+  }
+}
+
+
+// Issue draw commands first ... first+n-1.  Without
+// ARB_multi_draw_indirect (OpenGL 4.3), they are issued one by one.
+
+void wfModel::multiDraw( int first, int n )
+
+{
+  if (GLEW_ARB_multi_draw_indirect) {
+    glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid *) (first * sizeof(wfDrawCommand)),
+				 n, sizeof(wfDrawCommand) );
+    return;
+  }
+
+  for (int i=first; i<first+n; i++) {
+
+    wfDrawCommand &cmd = drawCommands[i];
+
+    if (cmd.instanceCount == 0)
+      continue;
+
+    pointToInstances( instanceBuffer, cmd.baseInstance );
+    glDrawElementsInstancedBaseVertex( GL_TRIANGLES, cmd.count, GL_UNSIGNED_INT,
+				       (const GLvoid *) (cmd.firstIndex * sizeof(GLuint)),
+				       cmd.instanceCount, cmd.baseVertex );
+  }
+}
+
+
 void wfMaterial::setMaterial( bool useTextures, bool useMaterial, GPUProgram * gpuProg )
 
 {
+  PROFILE_ZONE( "wfMaterial::setMaterial" );
+
   if (useMaterial) {
     gpuProg->setVec3( "kd", vec3( &diffuse[0] ) );
     gpuProg->setVec3( "ks", vec3( &specular[0] ) );
@@ -726,142 +1372,155 @@ void wfMaterial::setMaterial( bool useTextures, bool useMaterial, GPUProgram * g
   }
 
   if (useTextures) {
-    if (texmap == NULL) {
-      glDisable( GL_TEXTURE_2D );
-      glDisable(GL_BLEND);
-    } else {
-      glEnable( GL_TEXTURE_2D );
-      glActiveTexture( GL_TEXTURE0 ); // use texture unit zero
-      glBindTexture( GL_TEXTURE_2D, textureID );
+    if (!hasTexture())
+      GLState::disable( GL_BLEND );
+    else {
+      GLState::bindTexture( 0, textureID, GL_TEXTURE_2D_ARRAY ); // use texture unit zero
       gpuProg->setInt( "texSampler", 0 );
       if (hasAlpha) {
-	glEnable(GL_BLEND);
+	GLState::enable( GL_BLEND );
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
       } else
-	glDisable(GL_BLEND);
+	GLState::disable( GL_BLEND );
     }
   }
 }
 
 
 
-void wfMaterial::storeTexture()
+void wfMaterial::storeTexture( TextureUploader &uploader )
 
 {
-  unsigned int xdim, ydim;
-  GLubyte *p, *q;
-
-  xdim = width;
-  ydim = height;
-
-  // Create texture map of size 2^k x 2^l, filling blank space with black
-
-  GLubyte *newTexMap = new GLubyte[ xdim * ydim * (hasAlpha ? 4 : 3) ];
+  if (compressed != NULL) {
+    for (int l=0; l<compressed->numLevels; l++)
+      uploader.storeCompressedLayer( l, layer, mipLevelSize( width, l ), mipLevelSize( height, l ),
+				     compressed->format, compressed->levels[l], compressed->levelBytes( l ) );
+    return;
+  }
 
-  p = &newTexMap[0];		// destination
-  q = texmap;			// source
+  for (int l=0; l<numLevels; l++)
+    uploader.storeLayer( l, layer, mipLevelSize( width, l ), mipLevelSize( height, l ),
+			 (hasAlpha ? GL_RGBA : GL_RGB), levels[l] );
+}
 
-  for (unsigned int y=0; y<ydim; y++)
-    for (unsigned int x=0; x<xdim; x++)
-      if (y >= height || x >= width) {
-	*p++ = 0; *p++ = 0; *p++ = 0; // black outside of map
-	if (hasAlpha) *p++ = 0;
-      } else {
-	*p++ = *q++; *p++ = *q++; *p++ = *q++; // copy from source
-	if (hasAlpha) { *p++ = *q++; }
-      }
 
-  // Register it with OpenGL
+/* Give each material's texture a layer in a texture array of its size
+ * and format.  Go through the materials, not the groups, since
+ * several groups can share one material.  This needs no OpenGL
+ * context.
+ */
 
-  glBindTexture( GL_TEXTURE_2D, textureID );
 
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+void wfModel::assignLayers()
 
-  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+{
+  for (int i=0; i<materials.size(); i++) {
 
-#if 1
+    wfMaterial *m = materials[i];
 
-  // ordinary texture
+    if (!m->hasTexture() || m->arrayIndex >= 0)
+      continue;
 
-  //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-  //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    int a;
+    for (a=0; a<textureArrays.size(); a++) {
+      wfTextureArray *array = textureArrays[a];
+      if (array->width == m->width && array->height == m->height &&
+	  array->hasAlpha == m->hasAlpha && array->compressed == (m->compressed != NULL) &&
+	  array->numLayers < MAX_LAYERS)
+	break;
+    }
 
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    if (a == textureArrays.size()) {
+      wfTextureArray *array = new wfTextureArray();
+      array->width = m->width;
+      array->height = m->height;
+      array->hasAlpha = m->hasAlpha;
+      array->compressed = (m->compressed != NULL);
+      array->numLayers = 0;
+      array->textureID = 0;
+      textureArrays.add( array );
+    }
 
-  glTexImage2D( GL_TEXTURE_2D, 0, (hasAlpha ? GL_RGBA : GL_RGB), xdim, ydim, 0,
-		(hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, newTexMap );
+    m->arrayIndex = a;
+    m->layer = textureArrays[a]->numLayers++;
+  }
+}
 
-#else
 
-  // mip-mapped texture
+/* Initialize the textures by giving each texture array an OpenGL ID
+* and storage for all its layers and mipmap levels, then storing each
+* material's texture in its layer through a TextureUploader.
+*/
 
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-  glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
 
-  //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-  //glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+void wfModel::initTextures()
 
-  gluBuild2DMipmaps( GL_TEXTURE_2D, (hasAlpha ? GL_RGBA : GL_RGB), xdim, ydim,
-		     (hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, newTexMap );
+{
+  PROFILE_ZONE( "wfModel::initTextures" );
 
-#endif
+  // Pixel buffer slots as big as the largest texture
 
-  delete [] newTexMap;
-}
+  long maxBytes = 0;
 
+  for (int a=0; a<textureArrays.size(); a++) {
+    wfTextureArray *array = textureArrays[a];
+    long bytes = (long) array->width * array->height * (array->hasAlpha ? 4 : 3);
+    if (bytes > maxBytes)
+      maxBytes = bytes;
+  }
 
-/* Initialize the textures by assigning each an OpenGL ID and storing
-* each with OpenGL.
-*/
+  TextureUploader uploader( maxBytes );
 
+  for (int a=0; a<textureArrays.size(); a++) {
 
-void wfModel::initTextures()
+    wfTextureArray *array = textureArrays[a];
 
-{
-  // Count the textures
+    glGenTextures( 1, &array->textureID );
+    GLState::bindTexture( 0, array->textureID, GL_TEXTURE_2D_ARRAY );
 
-  int count = 0;
-  int countGroups = 0;
-  for (int i=0; i<groups.size(); i++) {
-    if (groups[i]->material->texmap != NULL)
-      count++;
-    if (groups[i]->triangles.size() > 0)
-      countGroups++;
-  }
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
-  // Generate OpenGL texture IDs
+    // All levels, filled from each material's mipmaps
 
-  GLuint *ids = new GLuint[ count ];
-  glGenTextures( count, &ids[0] );
+    int numLevels = numMipLevels( array->width, array->height );
 
-  // Assign the IDs and store the textures
+    if (array->compressed)
+      glTexStorage3D( GL_TEXTURE_2D_ARRAY, numLevels,
+		      (array->hasAlpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT),
+		      array->width, array->height, array->numLayers );
+    else
+      for (int l=0; l<numLevels; l++)
+	glTexImage3D( GL_TEXTURE_2D_ARRAY, l, (array->hasAlpha ? GL_RGBA8 : GL_RGB8),
+		      mipLevelSize( array->width, l ), mipLevelSize( array->height, l ), array->numLayers, 0,
+		      (array->hasAlpha ? GL_RGBA : GL_RGB), GL_UNSIGNED_BYTE, NULL );
 
-  int j = 0;
+    // Store the textures of this array's materials
 
-  for (int i=0; i<groups.size(); i++)
-    if (groups[i]->material->texmap != NULL) {
-      groups[i]->material->textureID = ids[j++];
-      groups[i]->material->storeTexture();
-    }
+    for (int i=0; i<materials.size(); i++)
+      if (materials[i]->arrayIndex == a) {
+	materials[i]->textureID = array->textureID;
+	materials[i]->storeTexture( uploader );
+      }
+  }
 
-  delete [] ids;
+  texturesInitialized = true;
 }
 
 
 
-/* Read a texture from a P6 PPM file
-*/
+/* Read a texture from a P6 PPM file.  The file is mapped into memory
+ * and the texture is its pixels where they lie, rows top to bottom, as
+ * all textures are kept (see buildBuffers()).  The mapping lasts until
+ * the texture is freed.
+ */
 
 
 unsigned char *wfMaterial::readP6( char *filename )
 
 {
-  char buffer[1000];
-  int i, xdim, ydim;
-  unsigned char *a, *b, *pa, *pb;
-
   int f = open( filename, O_RDONLY );
 
   if (f == -1) {
@@ -869,69 +1528,76 @@ unsigned char *wfMaterial::readP6( char *filename )
     exit(1);
   }
 
-  // first line
+  struct stat info;
+  fstat( f, &info );
 
-  do {
-    i = 0;
-    do 
-      read(f,&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
+  size_t bytes = info.st_size;
+  void *file = mmap( NULL, bytes, PROT_READ, MAP_PRIVATE, f, 0 );
 
-  if (strncmp( buffer, "P6", 2 ) != 0) {
-    cerr << filename << " is not a P6 file.\n";
+  close(f);
+
+  if (file == MAP_FAILED) {
+    cerr << "Mapping of `" << filename << "' failed.\n";
     exit(1);
   }
 
-  // second line
-
-  do {
-    i = 0;
-    do 
-      read(f,&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  buffer[i] = '\0';
-  sscanf( buffer, "%d %d", &xdim, &ydim );
-
-  width = xdim;
-  height = ydim;
-
-  // third line
-
-  do {
-    i = 0;
-    do 
-      read(f,&buffer[i],1);
-    while (buffer[i++] != '\n');
-  } while (buffer[0] == '#');
-  if (strncmp( buffer, "255", 3 ) != 0) {
-    cerr << filename << " is not a 24-bit file.\n";
+  // The header is "P6", then the width, height and maximum value, each
+  // after white space and comments, then one white space character
+
+  const unsigned char *p = (const unsigned char *) file;
+  const unsigned char *end = p + bytes;
+
+  if (bytes < 2 || p[0] != 'P' || p[1] != '6') {
+    cerr << filename << " is not a P6 file.\n";
     exit(1);
   }
 
-  // read the data (stored top-to-bottom, left-to-right)
+  p += 2;
+
+  int fields[3];
+
+  for (int i=0; i<3; i++) {
+
+    while (p < end && (isspace(*p) || *p == '#'))
+      if (*p == '#')
+	while (p < end && *p != '\n')
+	  p++;
+      else
+	p++;
+
+    if (p == end || !isdigit(*p)) {
+      cerr << filename << " has a bad header.\n";
+      exit(1);
+    }
+
+    fields[i] = 0;
+    while (p < end && isdigit(*p))
+      fields[i] = 10 * fields[i] + (*p++ - '0');
+  }
 
-  a = new unsigned char[ xdim * ydim * 3 ];
-  read( f, a, xdim*ydim*3 );
+  p++;
 
-  // flip the image vertically (stored bottom-to-top, left-to-right)
+  if (fields[2] != 255) {
+    cerr << filename << " is not a 24-bit file.\n";
+    exit(1);
+  }
 
-  b = new unsigned char[ xdim * ydim * 3 ];
+  width = fields[0];
+  height = fields[1];
 
-  for (int i=0; i<ydim; i++) {
-    pa = a + (i)*xdim*3;
-    pb = b + (ydim-1-i)*xdim*3;
-    for (int j=0; j<xdim*3; j++)
-      *(pb++) = *(pa++);
+  if (p + (size_t) width * height * 3 > end) {
+    cerr << filename << " is too short.\n";
+    exit(1);
   }
 
-  delete [] a;
+  madvise( file, bytes, MADV_WILLNEED );
+
+  mapping = file;
+  mappingBytes = bytes;
 
   hasAlpha = false;
 
-  close(f);
-  return b;
+  return (unsigned char *) p;
 }
 
 
@@ -1057,7 +1723,7 @@ unsigned char *wfMaterial::readPNG( char *filename )
 
   b = pb = new unsigned char[ imageSize ];
 
-  for (int r=(int)info_ptr->height - 1; r >= 0; r--) {
+  for (int r=0; r<(int)info_ptr->height; r++) { // top to bottom, as for a PPM
     png_bytep row = info_ptr->row_pointers[r];
     int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
     for (int c=0; c < rowbytes; c++)
@@ -14,6 +14,11 @@
 #include "linalg.h"
 #include "shadeMode.h"
 #include "gpuProgram.h"
+#include "textureUploader.h"
+#include "threadPool.h"
+#include "compressedTexture.h"
+
+#include <atomic>
 
 
 /* A material with lighting properties and perhaps a texture map
@@ -35,12 +40,31 @@ class wfMaterial {
   GLfloat emissive[4];		/* emmissive component */
   GLfloat shininess;		/* specular exponent */
 
-  GLubyte *texmap;		/* texture map */
+  GLubyte *texmap;		/* texture map, top row first */
+  void    *mapping;		/* file mapped into memory that texmap lies in (NULL = none) */
+  size_t   mappingBytes;
+  char    *texmapFilename;	/* map_Kd file, until it is loaded */
+  GLubyte **levels;		/* mipmaps; levels[0] is texmap */
+  int     numLevels;
+  CompressedTexture *compressed; /* all levels, compressed (NULL = not compressed) */
   unsigned int width, height;   /* texmap dimensions */
-  GLuint  textureID;		/* the OpenGL ID for this texture */
+  GLuint  textureID;		/* the OpenGL ID of the texture array holding texmap */
+  int     arrayIndex;		/* which of the model's texture arrays (-1 = none) */
+  int     layer;		/* texmap's layer in that array */
   bool    hasAlpha;		/* texmap has alpha component */
 
-  wfMaterial() {}
+  wfMaterial() {
+    name = NULL;
+    texmap = NULL;
+    textureID = 0;
+    arrayIndex = -1;
+    layer = 0;
+    texmapFilename = NULL;
+    mapping = NULL;
+    compressed = NULL;
+    levels = NULL;
+    numLevels = 0;
+  }
 
   wfMaterial( char *n ) {
     name = new char[ strlen(n)+1 ];
@@ -53,15 +77,55 @@ class wfMaterial {
     shininess = 0;
     texmap = NULL;
     width = height = 0;
+    textureID = 0;
+    arrayIndex = -1;
+    layer = 0;
+    texmapFilename = NULL;
+    mapping = NULL;
+    compressed = NULL;
+    levels = NULL;
+    numLevels = 0;
   }
 
   ~wfMaterial() {
+    freeMipmaps();
+    freeTexmap();
+    delete compressed;
     delete [] name;
+    delete [] texmapFilename;
   }
 
   void loadTexmap( char *filename ); /* read a ppm texture map */
-  void storeTexture();		     /* record texture with OpenGL */
+  void buildMipmaps( ThreadPool *pool ); /* make levels from texmap */
+  void freeMipmaps();
+  void freeTexmap();
+  bool readCompressed();	     /* from the cache of texmapFilename */
+
+  bool hasTexture() {
+    return texmap != NULL || compressed != NULL;
+  }
+  void storeTexture( TextureUploader &uploader ); /* record texture in its layer of the bound array */
   void setMaterial( bool useTex, bool useMat, GPUProgram * gpuProg ); /* set the current OpenGL context */
+
+  bool sameState( wfMaterial *m ) { /* setMaterial() sets the same texture and blending for m */
+    return arrayIndex == m->arrayIndex;
+  }
+};
+
+
+/* Textures of the same size and format, stored as the layers of one
+ * GL_TEXTURE_2D_ARRAY.  Materials whose textures share an array need
+ * no texture bind between them: each vertex carries its layer.
+ */
+
+
+class wfTextureArray {
+ public:
+  unsigned int width, height;
+  bool   hasAlpha;
+  bool   compressed;		/* S3TC */
+  int    numLayers;
+  GLuint textureID;
 };
 
 
@@ -88,15 +152,16 @@ class wfGroup {
   char             *name;	/* name of this group */
   seq<wfTriangle*> triangles;	/* triangles of this group */
   wfMaterial       *material;	/* material for group */
-  GLuint           VAO;
-  bool             VAOinitialized;
+
+  vec3  min, max;		/* extents, for culling */
+  vec3  centre;
+  float radius;
 
   wfGroup() {}
 
   wfGroup( char *gname ) {
     name = new char[ strlen(gname)+1 ];
     strcpy( name, gname );
-    VAOinitialized = false;
   }
 
   ~wfGroup() {
@@ -107,6 +172,8 @@ class wfGroup {
     name = strdup(source.name);
     triangles = source.triangles;
     material = source.material;
+    min = source.min;  max = source.max;
+    centre = source.centre;  radius = source.radius;
   }
 
   wfGroup const &operator=( wfGroup const &src ) { // assignment operator
@@ -114,17 +181,76 @@ class wfGroup {
       name = strdup(src.name);
       triangles = src.triangles;
       material = src.material;
+      min = src.min;  max = src.max;
+      centre = src.centre;  radius = src.radius;
     }
     return *this;
   }
 };
 
 
+/* The extents of a draw's groups, and a sphere around them
+ */
+
+
+class wfBounds {
+ public:
+  vec3  min, max;
+  vec3  centre;
+  float radius;
+};
+
+
+/* A flat copy of a model's triangles, for code that renders without
+ * OpenGL
+ */
+
+
+class wfMesh {
+ public:
+  int     numPositions;
+  vec3   *positions;		/* model vertices */
+  int     numTriangles;
+  GLuint *indices;		/* three per triangle, into positions */
+  vec3   *normals;		/* three per triangle: vertex normals, or else the facet normal */
+
+  wfMesh() {
+    numPositions = numTriangles = 0;
+    positions = normals = NULL;
+    indices = NULL;
+  }
+
+  ~wfMesh() {
+    delete [] positions;
+    delete [] indices;
+    delete [] normals;
+  }
+};
+
+
+/* One draw of glMultiDrawElementsIndirect, laid out as OpenGL
+ * expects
+ */
+
+
+class wfDrawCommand {
+ public:
+  GLuint count;			/* number of indices */
+  GLuint instanceCount;
+  GLuint firstIndex;		/* first index in the index buffer */
+  GLint  baseVertex;		/* added to each index */
+  GLuint baseInstance;
+};
+
+
 /* A model consisting of groups
  */
 
 
 class wfModel {
+
+  friend class GPUCuller;	/* reads the draws, bounds, and instances */
+
   char*    pathname;		/* path to this model */
   char*    mtllibname;		/* name of the material library */
 
@@ -144,11 +270,75 @@ class wfModel {
   wfMaterial* findMaterial( char *name );            /* find a named material */
   wfGroup*    findGroup( char *name );               /* find a named group */
   void        readMaterialLibrary( char *filename ); /* read all materials */
-  void        initTextures();	                     /* assign texture IDs and store all textures */
+  void        assignLayers();	                     /* put each texture in a layer of a texture array */
+  void        loadTextures();	                     /* decode all textures named by materials */
+  void        initTextures();	                     /* store all texture arrays */
+
+  enum { MAX_LAYERS = 256 };	/* per texture array; OpenGL 3.3 allows at least 256 */
+
+  seq<wfTextureArray*> textureArrays;
 
   int lineNum;
 
-  unsigned int nFaces;
+  // All groups' vertices and triangles in one vertex and one index
+  // buffer, with one draw command per material, sorted by state (see
+  // buildBuffers())
+
+  GLfloat       *vertexData;	/* vertexSize floats per vertex; texture coordinates are (s,t,layer) */
+  unsigned int   vertexSize, numVertices;
+  GLuint        *indexData;	/* relative to each draw's baseVertex */
+  unsigned int   numIndices;
+  wfDrawCommand *drawCommands;	/* instanceCount and baseInstance are set by each draw() */
+  int           *drawMaterials;	/* material (index into materials) of each draw */
+  wfBounds      *drawBounds;	/* bounds of each draw's groups, for culling */
+  int            numDraws;
+  bool           buffersBuilt;
+
+  GLuint VAO, VBO, IBO, drawBuffer;
+  bool   VAOinitialized;
+
+  // Copies of the model, each with its own OCS transform
+
+  int    numInstances;
+  mat4  *instanceTransforms;
+  float *instanceScales;	/* how much each transform enlarges a sphere */
+
+  // The transforms of the instances that each draw sees, after
+  // culling.  Draw d's are at visibleTransforms[baseInstance].
+
+  mat4  *visibleTransforms;
+  int    numVisible, maxVisible;
+  GLuint instanceBuffer;	/* copy of visibleTransforms */
+
+  unsigned int instancesID;	/* changes with each setInstances() */
+  static std::atomic<unsigned int> nextInstancesID; /* models are read on several threads */
+
+  void multiDraw( int first, int n );
+  void drawRuns( GPUProgram *gpuProg );
+  void cull( mat4 &MVP, bool allInstances );
+  void addVisible( mat4 &T );
+  void pointToInstances( GLuint buffer, int first );
+
+  void init() {
+    texturesInitialized = false;
+    pathname = mtllibname = NULL;
+    vertexData = NULL;
+    indexData = NULL;
+    drawCommands = NULL;
+    drawMaterials = NULL;
+    drawBounds = NULL;
+    numDraws = 0;
+    buffersBuilt = false;
+    VAOinitialized = false;
+    numInstances = 1;
+    instanceTransforms = new mat4[1];
+    instanceTransforms[0] = identity();
+    instanceScales = new float[1];
+    instanceScales[0] = 1;
+    visibleTransforms = NULL;
+    numVisible = maxVisible = 0;
+    instancesID = nextInstancesID++;
+  }
 
  public:
 
@@ -158,28 +348,49 @@ class wfModel {
   // Global vars controlling the rendering
 
   static bool newGroupWithNewMaterial; /* create a new group each time the material changes */
+  static ThreadPool *texturePool;      /* decodes textures and makes mipmaps (NULL = this thread) */
+  static bool compressTextures;	       /* store textures S3TC-compressed, cached on disk */
   static bool verticesAreCW;	       /* calculate opposite-to-usual face normals */
 
   vec3 min, max;		/* extents */
 
   wfModel() {
-    texturesInitialized = false;
-    pathname = mtllibname = NULL;
+    init();
   }
 
   wfModel( char *filename ) {
-    texturesInitialized = false;
-    pathname = mtllibname = NULL;
+    init();
     read( filename );
     setupVAO();
   }
 
-  ~wfModel() {
-  }
+  ~wfModel();			/* frees the triangles and OpenGL objects */
 
   void read( char *filename );         /* instantiate this model from a file */
-  void draw( GPUProgram * gpuProg );
-  void setupVAO();
+  enum { INSTANCE_ATTRIB = 3 };	/* instance transform rows are attributes 3-6 */
+
+  void draw( GPUProgram * gpuProg, mat4 &MVP, bool allInstances = true ); /* draw what MVP can see */
+  void drawIndirect( GPUProgram * gpuProg, GLuint commands, GLuint transforms ); /* draw commands culled elsewhere */
+  void setInstances( int n, mat4 *transforms ); /* draw n copies, each transformed */
+
+  int numTriangles() {		/* in one copy of the model */
+    int n = 0;
+    for (int i=0; i<groups.size(); i++)
+      n += groups[i]->triangles.size();
+    return n;
+  }
+
+  int getNumInstances() {
+    return numInstances;
+  }
+
+  mat4 &instanceTransform( int i ) {
+    return instanceTransforms[i];
+  }
+
+  void buildBuffers();		       /* fill the vertex, index and draw buffers (no OpenGL) */
+  void setupVAO();		       /* store the buffers and textures with OpenGL */
+  void buildMesh( wfMesh &mesh );      /* flat copy of all triangles */
 
   void checkVindex( int v ) {
     if (v < 0 || v >= vertices.size()) {